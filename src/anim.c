@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "anim.h"
+#include "util.h"
+
+bool anim_parse_format(const char *ext, AnimFormat *format) {
+    if (ext && strcmp(ext, "avi") == 0) {
+        *format = ANIM_AVI;
+        return true;
+    } else if (ext && strcmp(ext, "apng") == 0) {
+        *format = ANIM_APNG;
+        return true;
+    } else if (ext && strcmp(ext, "gif") == 0) {
+        *format = ANIM_GIF;
+        return true;
+    }
+
+    return false;
+}
+
+AnimWriter *anim_writer_new(const char *path, AnimFormat format, int width,
+    int height, int frame_count) {
+    AnimWriter *self = calloc(1, sizeof(AnimWriter));
+    if (!self) {
+        u_error("[anim_writer_new] Failed to allocate AnimWriter structure.");
+        return NULL;
+    }
+    self->format = format;
+
+    switch (format) {
+    case ANIM_AVI:
+        self->avi = avi_writer_new(path, width, height, frame_count,
+            ANIM_FPS);
+        if (!self->avi) {
+            free(self);
+            return NULL;
+        }
+        break;
+    case ANIM_APNG:
+        self->apng = apng_writer_new(path, width, height, frame_count,
+            ANIM_FPS);
+        if (!self->apng) {
+            free(self);
+            return NULL;
+        }
+        break;
+    case ANIM_GIF:
+        self->gif = gif_writer_new(path, width, height, ANIM_FPS);
+        if (!self->gif) {
+            free(self);
+            return NULL;
+        }
+        break;
+    }
+
+    return self;
+}
+
+bool anim_write_frame(AnimWriter *self, const YCCPicture *picture) {
+    switch (self->format) {
+    case ANIM_AVI:
+        return avi_write_frame(self->avi, picture);
+    case ANIM_APNG:
+        return apng_write_frame(self->apng, picture);
+    case ANIM_GIF:
+        return gif_write_frame(self->gif, picture);
+    }
+
+    return false;
+}
+
+bool anim_writer_close(AnimWriter **selfp) {
+    AnimWriter *self = *selfp;
+    bool rc = false;
+
+    switch (self->format) {
+    case ANIM_AVI:
+        rc = avi_writer_close(&self->avi);
+        break;
+    case ANIM_APNG:
+        rc = apng_writer_close(&self->apng);
+        break;
+    case ANIM_GIF:
+        rc = gif_writer_close(&self->gif);
+        break;
+    }
+
+    free(self);
+    *selfp = NULL;
+
+    return rc;
+}
+
@@ -0,0 +1,39 @@
+#ifndef __ANIM_H_
+#define __ANIM_H_
+
+#include <stdbool.h>
+#include "picture.h"
+#include "avi.h"
+#include "apng.h"
+#include "gif.h"
+
+#define ANIM_FPS    25 /* SECAM's own */
+
+/*
+ * Writers of all frames of a render into a single file. Frames come in
+ * order, one at a time, and go out before the next one is asked for.
+ */
+typedef enum {
+    ANIM_AVI,
+    ANIM_APNG,
+    ANIM_GIF
+} AnimFormat;
+
+typedef struct {
+    AnimFormat  format;
+    AviWriter   *avi;
+    ApngWriter  *apng;
+    GifWriter   *gif;
+} AnimWriter;
+
+// Takes an animation format by file extension. Returns false for
+// anything else, which is saved frame by frame.
+bool anim_parse_format(const char *ext, AnimFormat *format);
+
+AnimWriter *anim_writer_new(const char *path, AnimFormat format, int width,
+    int height, int frame_count);
+bool anim_write_frame(AnimWriter *self, const YCCPicture *picture);
+bool anim_writer_close(AnimWriter **selfp);
+
+#endif
+
@@ -0,0 +1,427 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "stb_image_write.h"
+
+#include "apng.h"
+#include "convert.h"
+#include "tpool.h"
+#include "cpu.h"
+#include "util.h"
+
+#define ACTL_AT             (8 + 12 + 13) // after the signature and IHDR
+
+#define APNG_DISPOSE_NONE   0
+#define APNG_BLEND_SOURCE   0
+#define APNG_BLEND_OVER     1
+
+// Defined, but not declared, by stb_image_write
+unsigned char *stbi_zlib_compress(unsigned char *data, int data_len,
+    int *out_len, int quality);
+
+typedef struct {
+    ApngWriter          *writer;
+    const YCCPicture    *picture;
+    int                 x; // box of the frame to be stored
+    int                 y;
+    int                 width;
+    int                 height;
+    bool                whole; // nothing came before, every pixel is new
+    int                 strip_rows;
+    atomic_bool         failed;
+} ApngJob;
+
+static uint32_t crc_table[256];
+
+static void apng_build_crc_table(void) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+        crc_table[n] = c;
+    }
+}
+
+static uint32_t apng_crc(uint32_t crc, const uint8_t *data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+// Writes a chunk of `head` followed by `data`, either may be empty.
+static void apng_chunk(FILE *file, const char *type, const uint8_t *head,
+    size_t head_length, const uint8_t *data, size_t length) {
+    uint8_t bytes[8];
+
+    u_put_be32(bytes, head_length + length);
+    memcpy(bytes + 4, type, 4);
+    fwrite(bytes, 1, 8, file);
+    uint32_t crc = apng_crc(0xFFFFFFFF, bytes + 4, 4);
+
+    if (head_length > 0) {
+        fwrite(head, 1, head_length, file);
+        crc = apng_crc(crc, head, head_length);
+    }
+    if (length > 0) {
+        fwrite(data, 1, length, file);
+        crc = apng_crc(crc, data, length);
+    }
+    u_put_be32(bytes, crc ^ 0xFFFFFFFF);
+    fwrite(bytes, 1, 4, file);
+}
+
+static void apng_actl(FILE *file, int frame_count) {
+    uint8_t actl[8];
+
+    u_put_be32(actl, frame_count);
+    u_put_be32(actl + 4, 0); // loop forever
+    apng_chunk(file, "acTL", actl, sizeof(actl), NULL, 0);
+}
+
+ApngWriter *apng_writer_new(const char *path, int width, int height,
+    int frame_count, int fps) {
+    ApngWriter *self = calloc(1, sizeof(ApngWriter));
+    if (!self) {
+        u_error("[apng_writer_new] Failed to allocate ApngWriter structure.");
+        return NULL;
+    }
+
+    size_t pixels = (size_t)width * height;
+    self->width = width;
+    self->height = height;
+    self->frame_count = frame_count;
+    self->fps = fps;
+    self->previous = malloc(pixels * 3);
+    self->current = malloc(pixels * 3);
+    self->extents = malloc(sizeof(int) * 2 * height);
+    self->region = malloc(pixels * 4 + height);
+    if (!self->previous || !self->current || !self->extents
+        || !self->region) {
+        u_error("[apng_writer_new] Failed to allocate frame buffers.");
+        apng_writer_close(&self);
+        return NULL;
+    }
+
+    self->file = fopen(path, "wb");
+    if (!self->file) {
+        u_error("Unable to open \"%s\" for write.", path);
+        apng_writer_close(&self);
+        return NULL;
+    }
+
+    apng_build_crc_table();
+
+    static const uint8_t signature[8] = {
+        0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'
+    };
+    uint8_t ihdr[13] = { 0 };
+
+    u_put_be32(ihdr, width);
+    u_put_be32(ihdr + 4, height);
+    ihdr[8] = 8; // bits per channel
+    ihdr[9] = 6; // RGBA
+    fwrite(signature, 1, sizeof(signature), self->file);
+    apng_chunk(self->file, "IHDR", ihdr, sizeof(ihdr), NULL, 0);
+    apng_actl(self->file, frame_count);
+
+    return self;
+}
+
+// Converts rows to RGB and notes which of their pixels have changed.
+void apng_convert_strip(void *ctx, int strip) {
+    ApngJob *job = ctx;
+    ApngWriter *writer = job->writer;
+    const YCCPicture *self = job->picture;
+    int chroma_width = self->width / 4;
+    int first = strip * job->strip_rows;
+    int last = first + job->strip_rows;
+    if (last > self->height) {
+        last = self->height;
+    }
+
+    for (int y = first; y < last; y++) {
+        // Chroma rows are picked as ycc_to_rgb does
+        int top = (y / 2) * chroma_width;
+        int bottom = (y % 2 == 1 && y < self->height - 1)
+            ? top + chroma_width
+            : top;
+        uint8_t *rgb = writer->current + (size_t)y * self->width * 3;
+        const uint8_t *was = writer->previous + (size_t)y * self->width * 3;
+        int *extent = writer->extents + 2 * y;
+
+        conv_ycc_to_rgb_row(self->luma + y * self->width,
+            self->cb + top, self->cr + top,
+            self->cb + bottom, self->cr + bottom,
+            rgb, self->width);
+
+        if (job->whole) {
+            extent[0] = 0;
+            extent[1] = self->width - 1;
+        } else if (memcmp(rgb, was, self->width * 3) == 0) {
+            extent[0] = -1;
+        } else {
+            int left = 0;
+            int right = self->width - 1;
+            while (memcmp(rgb + left * 3, was + left * 3, 3) == 0) {
+                left++;
+            }
+            while (memcmp(rgb + right * 3, was + right * 3, 3) == 0) {
+                right--;
+            }
+            extent[0] = left;
+            extent[1] = right;
+        }
+    }
+}
+
+// Makes the RGBA row `y` of the box, with unchanged pixels transparent.
+static void apng_box_row(const ApngJob *job, int y, uint8_t *out) {
+    const ApngWriter *writer = job->writer;
+    size_t at = ((size_t)(job->y + y) * writer->width + job->x) * 3;
+    const uint8_t *rgb = writer->current + at;
+    const uint8_t *was = writer->previous + at;
+
+    for (int x = 0; x < job->width; x++, rgb += 3, was += 3, out += 4) {
+        if (job->whole || rgb[0] != was[0] || rgb[1] != was[1]
+            || rgb[2] != was[2]) {
+            out[0] = rgb[0];
+            out[1] = rgb[1];
+            out[2] = rgb[2];
+            out[3] = 255;
+        } else {
+            memset(out, 0, 4);
+        }
+    }
+}
+
+static int apng_paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return pb <= pc ? b : c;
+}
+
+static int apng_filtered(int type, int x, int a, int b, int c) {
+    switch (type) {
+    case 1:
+        return x - a;
+    case 2:
+        return x - b;
+    case 3:
+        return x - ((a + b) >> 1);
+    case 4:
+        return x - apng_paeth(a, b, c);
+    }
+    return x;
+}
+
+// Filters a row the way stb_image_write does: with whichever filter
+// gives the least sum of magnitudes.
+static void apng_filter_row(const uint8_t *row, const uint8_t *prior,
+    int length, uint8_t *out) {
+    int sums[5] = { 0 };
+
+    for (int i = 0; i < length; i++) {
+        int a = i >= 4 ? row[i - 4] : 0;
+        int c = i >= 4 ? prior[i - 4] : 0;
+        for (int type = 0; type < 5; type++) {
+            sums[type] += abs((signed char)
+                apng_filtered(type, row[i], a, prior[i], c));
+        }
+    }
+
+    int best = 0;
+    for (int type = 1; type < 5; type++) {
+        if (sums[type] < sums[best]) {
+            best = type;
+        }
+    }
+
+    *out++ = best;
+    for (int i = 0; i < length; i++) {
+        int a = i >= 4 ? row[i - 4] : 0;
+        int c = i >= 4 ? prior[i - 4] : 0;
+        out[i] = apng_filtered(best, row[i], a, prior[i], c);
+    }
+}
+
+void apng_filter_strip(void *ctx, int strip) {
+    ApngJob *job = ctx;
+    int length = job->width * 4;
+    int first = strip * job->strip_rows;
+    int last = first + job->strip_rows;
+    if (last > job->height) {
+        last = job->height;
+    }
+
+    uint8_t *rows = malloc(length * 2);
+    if (!rows) {
+        atomic_store(&job->failed, true);
+        return;
+    }
+    uint8_t *prior = rows;
+    uint8_t *row = rows + length;
+
+    // The row above the box counts as zeros
+    if (first == 0) {
+        memset(prior, 0, length);
+    } else {
+        apng_box_row(job, first - 1, prior);
+    }
+
+    for (int y = first; y < last; y++) {
+        apng_box_row(job, y, row);
+        apng_filter_row(row, prior, length,
+            job->writer->region + (size_t)y * (length + 1));
+
+        uint8_t *t = prior;
+        prior = row;
+        row = t;
+    }
+
+    free(rows);
+}
+
+// Finds the box around all changed pixels. An unchanged frame still
+// needs one, so it gets a single transparent pixel.
+static void apng_find_box(ApngJob *job) {
+    const ApngWriter *writer = job->writer;
+    int left = writer->width;
+    int right = -1;
+    int top = -1;
+    int bottom = -1;
+
+    for (int y = 0; y < writer->height; y++) {
+        const int *extent = writer->extents + 2 * y;
+        if (extent[0] < 0) {
+            continue;
+        }
+        if (top < 0) {
+            top = y;
+        }
+        bottom = y;
+        if (extent[0] < left) {
+            left = extent[0];
+        }
+        if (extent[1] > right) {
+            right = extent[1];
+        }
+    }
+
+    if (top < 0) {
+        job->x = job->y = 0;
+        job->width = job->height = 1;
+        return;
+    }
+
+    job->x = left;
+    job->y = top;
+    job->width = right - left + 1;
+    job->height = bottom - top + 1;
+}
+
+bool apng_write_frame(ApngWriter *self, const YCCPicture *picture) {
+    if (self->written == self->frame_count) {
+        u_error("[apng_write_frame] All %d frames are written already.",
+            self->frame_count);
+        return false;
+    }
+    if (picture->width != self->width || picture->height != self->height) {
+        u_error("[apng_write_frame] Frame is %dx%d, not %dx%d.",
+            picture->width, picture->height, self->width, self->height);
+        return false;
+    }
+
+    int rows = cpu_l2_size() / 2 / (self->width * 4);
+    ApngJob job = { .writer = self, .picture = picture,
+        .whole = self->written == 0, .strip_rows = rows < 2 ? 2 : rows };
+    tpool_for((self->height + job.strip_rows - 1) / job.strip_rows,
+        apng_convert_strip, &job);
+
+    apng_find_box(&job);
+    tpool_for((job.height + job.strip_rows - 1) / job.strip_rows,
+        apng_filter_strip, &job);
+    if (atomic_load(&job.failed)) {
+        u_error("[apng_write_frame] Failed to allocate filter rows.");
+        return false;
+    }
+
+    int length;
+    uint8_t *data = stbi_zlib_compress(self->region,
+        job.height * (job.width * 4 + 1), &length,
+        stbi_write_png_compression_level);
+    if (!data) {
+        u_error("[apng_write_frame] Failed to compress frame %d.",
+            self->written);
+        return false;
+    }
+
+    uint8_t fctl[26];
+    uint8_t *p = u_put_be32(fctl, self->sequence++);
+    p = u_put_be32(p, job.width);
+    p = u_put_be32(p, job.height);
+    p = u_put_be32(p, job.x);
+    p = u_put_be32(p, job.y);
+    p = u_put_be16(p, 1);
+    p = u_put_be16(p, self->fps);
+    *p++ = APNG_DISPOSE_NONE;
+    *p = job.whole ? APNG_BLEND_SOURCE : APNG_BLEND_OVER;
+    apng_chunk(self->file, "fcTL", fctl, sizeof(fctl), NULL, 0);
+
+    // The first frame is the default image as well
+    if (job.whole) {
+        apng_chunk(self->file, "IDAT", NULL, 0, data, length);
+    } else {
+        uint8_t sequence[4];
+        u_put_be32(sequence, self->sequence++);
+        apng_chunk(self->file, "fdAT", sequence, 4, data, length);
+    }
+    free(data);
+
+    // What's been converted now is what the next frame is compared to
+    uint8_t *t = self->previous;
+    self->previous = self->current;
+    self->current = t;
+    self->written++;
+
+    return !ferror(self->file);
+}
+
+bool apng_writer_close(ApngWriter **selfp) {
+    ApngWriter *self = *selfp;
+    bool rc = true;
+
+    if (self->file) {
+        FILE *file = self->file;
+
+        // Frames which never came are left out of the count
+        if (self->written != self->frame_count) {
+            long end = ftell(file);
+            fseek(file, ACTL_AT, SEEK_SET);
+            apng_actl(file, self->written);
+            fseek(file, end, SEEK_SET);
+        }
+        apng_chunk(file, "IEND", NULL, 0, NULL, 0);
+
+        rc = !ferror(file);
+        rc = fclose(file) == 0 && rc;
+    }
+
+    free(self->previous);
+    free(self->current);
+    free(self->extents);
+    free(self->region);
+    free(self);
+    *selfp = NULL;
+
+    return rc;
+}
+
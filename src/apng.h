@@ -0,0 +1,37 @@
+#ifndef __APNG_H_
+#define __APNG_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "picture.h"
+
+/*
+ * An animated PNG of RGBA frames, compressed by stb_image_write's zlib.
+ * The first frame is stored whole. Each of the others is only the box
+ * around the pixels that differ from the frame before it, with the
+ * unchanged ones inside the box left transparent and blended over.
+ */
+typedef struct {
+    FILE        *file;
+    int         width;
+    int         height;
+    int         frame_count;
+    int         fps;
+    int         written;
+    uint32_t    sequence; // of the next fcTL or fdAT chunk
+    uint8_t     *previous; // RGB of the last frame written
+    uint8_t     *current; // RGB of the frame being written
+    int         *extents; // first and last changed pixel of each row
+    uint8_t     *region; // filtered rows of the box, to be compressed
+} ApngWriter;
+
+ApngWriter *apng_writer_new(const char *path, int width, int height,
+    int frame_count, int fps);
+bool apng_write_frame(ApngWriter *self, const YCCPicture *picture);
+
+// Fixes up the frame count if fewer frames came, ends and closes the file.
+bool apng_writer_close(ApngWriter **selfp);
+
+#endif
+
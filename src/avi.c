@@ -0,0 +1,258 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "avi.h"
+#include "jpeg.h"
+#include "util.h"
+
+#define JPEG_QUALITY        0
+
+#define AVI_SIZE_MAX        (1L << 30) // where AVI 1.0 readers give up
+
+#define AVIF_HASINDEX       0x10
+#define AVIIF_KEYFRAME      0x10
+
+// Offsets of what can only be known at the end
+#define RIFF_SIZE_AT        4
+#define MAX_BYTES_AT        (32 + 4)
+#define FRAMES_AT           (32 + 16)
+#define AVIH_BUFFER_AT      (32 + 28)
+#define LENGTH_AT           (108 + 32)
+#define STRH_BUFFER_AT      (108 + 36)
+#define MOVI_SIZE_AT        (212 + 4)
+#define HEADER_SIZE         224
+
+typedef struct {
+    FILE        *file;
+    uint32_t    size;
+} AviChunk;
+
+static uint8_t *put_fourcc(uint8_t *p, const char *fourcc) {
+    memcpy(p, fourcc, 4);
+    return p + 4;
+}
+
+/*
+ * RIFF 'AVI ' with one MJPEG video stream:
+ *
+ *   LIST 'hdrl' { 'avih', LIST 'strl' { 'strh', 'strf' } }
+ *   LIST 'movi' { '00dc'... }
+ *   'idx1'
+ */
+static void avi_header(uint8_t *p, int width, int height, int frame_count,
+    int fps) {
+    p = put_fourcc(p, "RIFF");
+    p = u_put_le32(p, 0);
+    p = put_fourcc(p, "AVI ");
+
+    p = put_fourcc(p, "LIST");
+    p = u_put_le32(p, 4 + 8 + 56 + 8 + 4 + 8 + 56 + 8 + 40);
+    p = put_fourcc(p, "hdrl");
+
+    p = put_fourcc(p, "avih");
+    p = u_put_le32(p, 56);
+    p = u_put_le32(p, 1000000 / fps);
+    p = u_put_le32(p, 0); // max bytes per second
+    p = u_put_le32(p, 0);
+    p = u_put_le32(p, AVIF_HASINDEX);
+    p = u_put_le32(p, frame_count);
+    p = u_put_le32(p, 0);
+    p = u_put_le32(p, 1); // streams
+    p = u_put_le32(p, 0); // suggested buffer size
+    p = u_put_le32(p, width);
+    p = u_put_le32(p, height);
+    memset(p, 0, 16);
+    p += 16;
+
+    p = put_fourcc(p, "LIST");
+    p = u_put_le32(p, 4 + 8 + 56 + 8 + 40);
+    p = put_fourcc(p, "strl");
+
+    p = put_fourcc(p, "strh");
+    p = u_put_le32(p, 56);
+    p = put_fourcc(p, "vids");
+    p = put_fourcc(p, "MJPG");
+    p = u_put_le32(p, 0);
+    p = u_put_le32(p, 0); // priority and language
+    p = u_put_le32(p, 0);
+    p = u_put_le32(p, 1); // scale
+    p = u_put_le32(p, fps); // rate
+    p = u_put_le32(p, 0);
+    p = u_put_le32(p, frame_count);
+    p = u_put_le32(p, 0); // suggested buffer size
+    p = u_put_le32(p, 0xFFFFFFFF); // quality
+    p = u_put_le32(p, 0);
+    p = u_put_le16(p, 0);
+    p = u_put_le16(p, 0);
+    p = u_put_le16(p, width);
+    p = u_put_le16(p, height);
+
+    p = put_fourcc(p, "strf");
+    p = u_put_le32(p, 40);
+    p = u_put_le32(p, 40);
+    p = u_put_le32(p, width);
+    p = u_put_le32(p, height);
+    p = u_put_le16(p, 1);
+    p = u_put_le16(p, 24);
+    p = put_fourcc(p, "MJPG");
+    p = u_put_le32(p, (uint32_t)width * height * 3);
+    memset(p, 0, 16);
+    p += 16;
+
+    p = put_fourcc(p, "LIST");
+    p = u_put_le32(p, 0);
+    put_fourcc(p, "movi");
+}
+
+AviWriter *avi_writer_new(const char *path, int width, int height,
+    int frame_count, int fps) {
+    AviWriter *self = calloc(1, sizeof(AviWriter));
+    if (!self) {
+        u_error("[avi_writer_new] Failed to allocate AviWriter structure.");
+        return NULL;
+    }
+
+    self->frame_count = frame_count;
+    self->fps = fps;
+    self->index = malloc(sizeof(uint32_t) * 2 * frame_count);
+    if (!self->index) {
+        u_error("[avi_writer_new] Failed to allocate frame index.");
+        free(self);
+        return NULL;
+    }
+
+    self->file = fopen(path, "wb");
+    if (!self->file) {
+        u_error("Unable to open \"%s\" for write.", path);
+        free(self->index);
+        free(self);
+        return NULL;
+    }
+
+    uint8_t header[HEADER_SIZE];
+    avi_header(header, width, height, frame_count, fps);
+    fwrite(header, 1, sizeof(header), self->file);
+    self->movi_start = HEADER_SIZE - 4;
+
+    return self;
+}
+
+static void avi_chunk_write(void *context, void *data, int size) {
+    AviChunk *chunk = context;
+
+    fwrite(data, 1, size, chunk->file);
+    chunk->size += size;
+}
+
+bool avi_write_frame(AviWriter *self, const YCCPicture *picture) {
+    if (self->written == self->frame_count) {
+        u_error("[avi_write_frame] All %d frames are written already.",
+            self->frame_count);
+        return false;
+    }
+    if (self->full) {
+        return false;
+    }
+
+    long start = ftell(self->file);
+    uint8_t header[8] = { '0', '0', 'd', 'c' };
+    fwrite(header, 1, sizeof(header), self->file);
+
+    AviChunk chunk = { self->file, 0 };
+    if (!jpeg_write(picture, avi_chunk_write, &chunk, JPEG_QUALITY,
+        &self->jpeg)) {
+        return false;
+    }
+    if (chunk.size % 2 == 1) {
+        fputc(0, self->file);
+    }
+
+    // A frame that would take the file, index included, past the limit
+    // is taken back, and the file ends with the frames before it
+    long end = ftell(self->file);
+    if (end < 0 || end + 8 + 16L * (self->written + 1) > AVI_SIZE_MAX) {
+        u_error("[avi_write_frame] AVI is full at frame %d of %d, it can't "
+            "go past 1 GiB.", self->written, self->frame_count);
+        self->full = true;
+        fseek(self->file, start, SEEK_SET);
+        return false;
+    }
+
+    // Now that the size is known, back to the chunk header
+    u_put_le32(header + 4, chunk.size);
+    fseek(self->file, start + 4, SEEK_SET);
+    fwrite(header + 4, 1, 4, self->file);
+    fseek(self->file, end, SEEK_SET);
+
+    self->index[2 * self->written] = start - self->movi_start;
+    self->index[2 * self->written + 1] = chunk.size;
+    self->written++;
+
+    if (chunk.size > self->max_frame_size) {
+        self->max_frame_size = chunk.size;
+    }
+
+    return !ferror(self->file);
+}
+
+// Puts a little-endian value at `offset` of the file.
+static void avi_patch(FILE *file, long offset, uint32_t value) {
+    uint8_t bytes[4];
+
+    u_put_le32(bytes, value);
+    fseek(file, offset, SEEK_SET);
+    fwrite(bytes, 1, 4, file);
+}
+
+bool avi_writer_close(AviWriter **selfp) {
+    AviWriter *self = *selfp;
+    FILE *file = self->file;
+
+    long movi_end = ftell(file);
+    uint8_t entry[16];
+
+    put_fourcc(entry, "idx1");
+    u_put_le32(entry + 4, 16 * self->written);
+    fwrite(entry, 1, 8, file);
+
+    for (int i = 0; i < self->written; i++) {
+        put_fourcc(entry, "00dc");
+        u_put_le32(entry + 4, AVIIF_KEYFRAME);
+        u_put_le32(entry + 8, self->index[2 * i]);
+        u_put_le32(entry + 12, self->index[2 * i + 1]);
+        fwrite(entry, 1, 16, file);
+    }
+
+    long end = ftell(file);
+    bool rc = true;
+
+    // The frame taken back when the file got full may stick out past it
+    if (self->full) {
+        fflush(file);
+        rc = ftruncate(fileno(file), end) == 0;
+    }
+
+    avi_patch(file, RIFF_SIZE_AT, end - 8);
+    avi_patch(file, MOVI_SIZE_AT, movi_end - MOVI_SIZE_AT - 4);
+    avi_patch(file, MAX_BYTES_AT, self->max_frame_size * self->fps);
+    avi_patch(file, AVIH_BUFFER_AT, self->max_frame_size + 8);
+    avi_patch(file, STRH_BUFFER_AT, self->max_frame_size + 8);
+
+    // Frames which never came are left out of the count
+    if (self->written != self->frame_count) {
+        avi_patch(file, FRAMES_AT, self->written);
+        avi_patch(file, LENGTH_AT, self->written);
+    }
+
+    rc = !ferror(file) && rc;
+    rc = fclose(file) == 0 && rc;
+
+    free(self->index);
+    jpeg_buffers_free(&self->jpeg);
+    free(self);
+    *selfp = NULL;
+
+    return rc;
+}
+
@@ -0,0 +1,36 @@
+#ifndef __AVI_H_
+#define __AVI_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "picture.h"
+#include "jpeg.h"
+
+/*
+ * An AVI file of MJPEG frames. Headers go out first, counting on
+ * `frame_count` frames; frames are then appended as they are encoded,
+ * and their index follows them when the writer is closed. Frames
+ * stop at 1 GiB, as far as AVI 1.0 goes.
+ */
+typedef struct {
+    FILE        *file;
+    int         frame_count;
+    int         fps;
+    int         written;
+    uint32_t    *index; // offset and size of each frame, in `movi`
+    long        movi_start; // where `movi` begins, for the offsets
+    uint32_t    max_frame_size;
+    bool        full; // no more frames fit in 1 GiB, the AVI 1.0 limit
+    JpegBuffers jpeg; // encoder, kept from one frame to the next
+} AviWriter;
+
+AviWriter *avi_writer_new(const char *path, int width, int height,
+    int frame_count, int fps);
+bool avi_write_frame(AviWriter *self, const YCCPicture *picture);
+
+// Writes the index, fixes up sizes in the headers and closes the file.
+bool avi_writer_close(AviWriter **selfp);
+
+#endif
+
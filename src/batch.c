@@ -0,0 +1,289 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "batch.h"
+#include "picture.h"
+#include "queue.h"
+#include "tpool.h"
+#include "util.h"
+
+#define QUEUE_CAPACITY  4
+
+typedef char BatchPath[1024];
+
+typedef struct {
+    int         input; // index into self->batch_inputs
+    UFileData   file;
+    YCCPicture  *picture;
+    int         frame;
+} BatchItem;
+
+typedef struct {
+    Secamizer   *self;
+    Queue       *read_queue; // read -> decode
+    Queue       *decode_queue; // decode -> scan
+    Queue       *scan_queue; // scan -> save
+    int         read_failures;
+    int         decode_failures;
+    int         scan_failures;
+} Batch;
+
+static void batch_item_delete(BatchItem **itemp) {
+    BatchItem *item = *itemp;
+
+    u_unload_file(&item->file);
+    if (item->picture) {
+        ycc_delete(&item->picture);
+    }
+    free(item);
+
+    *itemp = NULL;
+}
+
+static void *batch_read(void *arg) {
+    Batch *batch = arg;
+    Secamizer *self = batch->self;
+
+    for (int i = 0; i < self->batch_count; i++) {
+        BatchItem *item = calloc(1, sizeof(BatchItem));
+        if (!item) {
+            u_error("[batch_read] Failed to allocate BatchItem structure.");
+            batch->read_failures++;
+            continue;
+        }
+        item->input = i;
+
+        if (!u_load_file(&item->file, self->batch_inputs[i])) {
+            batch->read_failures++;
+            batch_item_delete(&item);
+            continue;
+        }
+
+        queue_push(batch->read_queue, item);
+    }
+
+    queue_push(batch->read_queue, NULL);
+    return NULL;
+}
+
+static void *batch_decode(void *arg) {
+    Batch *batch = arg;
+    Secamizer *self = batch->self;
+    BatchItem *item;
+
+    while ((item = queue_pop(batch->read_queue))) {
+        item->picture = ycc_decode_picture(item->file.data, item->file.length,
+            self->force_480 ? 480 : -1);
+        u_unload_file(&item->file);
+
+        if (!item->picture) {
+            u_error("Can't open picture %s.", self->batch_inputs[item->input]);
+            batch->decode_failures++;
+            batch_item_delete(&item);
+            continue;
+        }
+
+        queue_push(batch->decode_queue, item);
+    }
+
+    queue_push(batch->decode_queue, NULL);
+    return NULL;
+}
+
+static void *batch_scan(void *arg) {
+    Batch *batch = arg;
+    Secamizer *self = batch->self;
+    BatchItem *source;
+
+    while ((source = queue_pop(batch->decode_queue))) {
+        for (int i = 0; i < self->frames; i++) {
+            BatchItem *item = calloc(1, sizeof(BatchItem));
+            if (!item) {
+                u_error("[batch_scan] Failed to allocate BatchItem structure.");
+                batch->scan_failures++;
+                continue;
+            }
+
+            item->input = source->input;
+            item->frame = i;
+            item->picture = secamizer_scan_frame(self, source->picture, i);
+            if (!item->picture) {
+                batch->scan_failures++;
+                batch_item_delete(&item);
+                continue;
+            }
+
+            queue_push(batch->scan_queue, item);
+        }
+
+        batch_item_delete(&source);
+    }
+
+    queue_push(batch->scan_queue, NULL);
+    return NULL;
+}
+
+// Builds "<batch_dir>/<input name>", with the extension swapped for the
+// forced output format if there is one.
+static void batch_output_path(Secamizer *self, char *path, size_t size,
+    const char *input) {
+    const char *name = strrchr(input, '/');
+    name = name ? name + 1 : input;
+
+    const char *ext = u_get_file_ext(name);
+    int name_length = ext ? (int)(ext - name - 1) : (int)strlen(name);
+
+    if (self->forced_output_format) {
+        snprintf(path, size, "%s/%.*s.%s", self->batch_dir, name_length, name,
+            self->forced_output_format);
+    } else {
+        snprintf(path, size, "%s/%s", self->batch_dir, name);
+    }
+}
+
+// Same paths stay in the order of their inputs
+static int batch_compare_paths(const void *a, const void *b) {
+    const char *pa = *(const char **)a;
+    const char *pb = *(const char **)b;
+    int rc = strcmp(pa, pb);
+
+    return rc != 0 ? rc : (pa > pb) - (pa < pb);
+}
+
+// Inputs of the same name from different directories would be saved over
+// one another, so that is refused before anything is read.
+static bool batch_check_paths(Secamizer *self) {
+    BatchPath *paths = malloc(sizeof(BatchPath) * self->batch_count);
+    const char **sorted = malloc(sizeof(const char *) * self->batch_count);
+    if (!paths || !sorted) {
+        u_error("[batch_check_paths] Failed to allocate output paths.");
+        free(paths);
+        free(sorted);
+        return false;
+    }
+
+    for (int i = 0; i < self->batch_count; i++) {
+        batch_output_path(self, paths[i], sizeof(BatchPath),
+            self->batch_inputs[i]);
+        sorted[i] = paths[i];
+    }
+    qsort(sorted, self->batch_count, sizeof(const char *),
+        batch_compare_paths);
+
+    bool ok = true;
+    int first = 0;
+    for (int i = 1; i < self->batch_count; i++) {
+        if (strcmp(sorted[first], sorted[i]) != 0) {
+            first = i;
+            continue;
+        }
+
+        int a = (const BatchPath *)sorted[first] - paths;
+        int b = (const BatchPath *)sorted[i] - paths;
+        u_error("%s and %s would both be saved as %s.",
+            self->batch_inputs[a], self->batch_inputs[b], sorted[i]);
+        ok = false;
+    }
+
+    free(paths);
+    free(sorted);
+    return ok;
+}
+
+bool batch_run(Secamizer *self) {
+    Batch batch = { self, NULL, NULL, NULL, 0, 0, 0 };
+    int save_failures = 0;
+
+    if (!batch_check_paths(self)) {
+        return false;
+    }
+
+    batch.read_queue = queue_new(QUEUE_CAPACITY);
+    batch.decode_queue = queue_new(QUEUE_CAPACITY);
+    batch.scan_queue = queue_new(QUEUE_CAPACITY);
+    if (!batch.read_queue || !batch.decode_queue || !batch.scan_queue) {
+        if (batch.read_queue) {
+            queue_delete(&batch.read_queue);
+        }
+        if (batch.decode_queue) {
+            queue_delete(&batch.decode_queue);
+        }
+        return false;
+    }
+
+    pthread_t reader, decoder, scanner;
+    if (tpool_spawn(&reader, batch_read, &batch)
+        || tpool_spawn(&decoder, batch_decode, &batch)
+        || tpool_spawn(&scanner, batch_scan, &batch)) {
+        u_error("[batch_run] Failed to start pipeline threads.");
+        exit(EXIT_FAILURE);
+    }
+
+    // Saving runs right here, as the last stage. Frames of an input come
+    // in order, so an animation is open for one input at a time.
+    AnimFormat format;
+    bool animated = anim_parse_format(self->forced_output_format, &format);
+    AnimWriter *anim = NULL;
+    int anim_input = -1;
+
+    BatchItem *item;
+    while ((item = queue_pop(batch.scan_queue))) {
+        BatchPath path;
+        char frame_name[1024];
+
+        batch_output_path(self, path, sizeof(path),
+            self->batch_inputs[item->input]);
+
+        if (animated) {
+            if (item->input != anim_input) {
+                if (anim && !anim_writer_close(&anim)) {
+                    save_failures++;
+                }
+                anim = anim_writer_new(path, format, item->picture->width,
+                    item->picture->height, self->frames);
+                anim_input = item->input;
+                if (anim) {
+                    u_message("%s -> %s", self->batch_inputs[item->input],
+                        path);
+                }
+            }
+            if (!anim || !anim_write_frame(anim, item->picture)) {
+                u_error("Failed to save frame %d of %s.", item->frame, path);
+                save_failures++;
+            }
+            batch_item_delete(&item);
+            continue;
+        }
+
+        const char *frame_path = secamizer_output_name(self, frame_name, path,
+            item->frame);
+
+        if (ycc_save_picture(item->picture, frame_path,
+            self->forced_output_format)) {
+            u_message("%s -> %s", self->batch_inputs[item->input], frame_path);
+        } else {
+            u_error("Failed to save %s.", frame_path);
+            save_failures++;
+        }
+
+        batch_item_delete(&item);
+    }
+
+    if (anim && !anim_writer_close(&anim)) {
+        save_failures++;
+    }
+
+    pthread_join(reader, NULL);
+    pthread_join(decoder, NULL);
+    pthread_join(scanner, NULL);
+
+    queue_delete(&batch.read_queue);
+    queue_delete(&batch.decode_queue);
+    queue_delete(&batch.scan_queue);
+
+    return batch.read_failures + batch.decode_failures + batch.scan_failures
+        + save_failures == 0;
+}
+
@@ -0,0 +1,16 @@
+#ifndef __BATCH_H_
+#define __BATCH_H_
+
+#include <stdbool.h>
+#include "secamizer.h"
+
+/*
+ * Secamizes every input into `self->batch_dir`. Reading, decoding,
+ * scanning and saving run on threads of their own, so that one picture
+ * can be decoded while the previous one is being scanned or saved.
+ * Returns false if any picture failed.
+ */
+bool batch_run(Secamizer *self);
+
+#endif
+
@@ -0,0 +1,140 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "bitmap.h"
+#include "convert.h"
+#include "tpool.h"
+#include "cpu.h"
+#include "util.h"
+
+#define BMP_HEADER_SIZE 54
+#define TGA_HEADER_SIZE 18
+
+typedef struct {
+    const YCCPicture    *picture;
+    uint8_t             *pixels; // bottom row first
+    size_t              row_bytes; // padding included
+    int                 strip_rows;
+} BitmapJob;
+
+// Same headers as stb_image_write puts out, minus TGA compression.
+static void bitmap_header(uint8_t *p, BitmapFormat format, int width,
+    int height, size_t file_size) {
+    if (format == BITMAP_BMP) {
+        *p++ = 'B';
+        *p++ = 'M';
+        p = u_put_le32(p, file_size);
+        p = u_put_le32(p, 0);
+        p = u_put_le32(p, BMP_HEADER_SIZE);
+        p = u_put_le32(p, 40);
+        p = u_put_le32(p, width);
+        p = u_put_le32(p, height);
+        p = u_put_le16(p, 1);
+        p = u_put_le16(p, 24);
+        memset(p, 0, 24);
+    } else {
+        memset(p, 0, TGA_HEADER_SIZE);
+        p[2] = 2; // uncompressed true colour
+        u_put_le16(p + 12, width);
+        u_put_le16(p + 14, height);
+        p[16] = 24;
+    }
+}
+
+void bitmap_write_strip(void *ctx, int strip) {
+    BitmapJob *job = ctx;
+    const YCCPicture *self = job->picture;
+    int chroma_width = self->width / 4;
+    int first = strip * job->strip_rows;
+    int last = first + job->strip_rows;
+    if (last > self->height) {
+        last = self->height;
+    }
+
+    for (int y = first; y < last; y++) {
+        // Chroma rows are picked as ycc_to_rgb does
+        int top = (y / 2) * chroma_width;
+        int bottom = (y % 2 == 1 && y < self->height - 1)
+            ? top + chroma_width
+            : top;
+
+        conv_ycc_to_bgr_row(self->luma + y * self->width,
+            self->cb + top, self->cr + top,
+            self->cb + bottom, self->cr + bottom,
+            job->pixels + (size_t)(self->height - 1 - y) * job->row_bytes,
+            self->width);
+    }
+}
+
+bool bitmap_write(const YCCPicture *picture, const char *path,
+    BitmapFormat format) {
+    size_t header_size = format == BITMAP_BMP
+        ? BMP_HEADER_SIZE
+        : TGA_HEADER_SIZE;
+    size_t row_bytes = (size_t)picture->width * 3;
+    if (format == BITMAP_BMP) {
+        row_bytes = (row_bytes + 3) & ~(size_t)3;
+    }
+    size_t file_size = header_size + row_bytes * picture->height;
+
+    // Neither format has room for more in its header
+    if (format == BITMAP_TGA
+        && (picture->width > 0xFFFF || picture->height > 0xFFFF)) {
+        u_error("[bitmap_write] TGA can't be %dx%d.", picture->width,
+            picture->height);
+        return false;
+    }
+    if (format == BITMAP_BMP && file_size > UINT32_MAX) {
+        u_error("[bitmap_write] BMP of %dx%d would be over 4 GiB.",
+            picture->width, picture->height);
+        return false;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        u_error("Unable to open \"%s\" for write.", path);
+        return false;
+    }
+
+    // Blocks are taken up front: stores to a hole the disk has no room
+    // for would raise SIGBUS in the workers. A fresh file reads as zeros,
+    // BMP row padding included.
+    int err = posix_fallocate(fd, 0, file_size);
+    if (err != 0) {
+        u_error("[bitmap_write] No room for \"%s\": %s.", path,
+            strerror(err));
+        close(fd);
+        return false;
+    }
+
+    uint8_t *data = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        u_error("[bitmap_write] Failed to map \"%s\".", path);
+        return false;
+    }
+
+    bitmap_header(data, format, picture->width, picture->height, file_size);
+
+    int rows = cpu_l2_size() / 2 / (picture->width * 4);
+    BitmapJob job = { picture, data + header_size, row_bytes,
+        rows < 2 ? 2 : rows };
+    tpool_for((picture->height + job.strip_rows - 1) / job.strip_rows,
+        bitmap_write_strip, &job);
+
+    // Write-back errors only show up here, not in munmap
+    bool rc = msync(data, file_size, MS_SYNC) == 0;
+    if (!rc) {
+        u_error("[bitmap_write] Failed to write \"%s\": %s.", path,
+            strerror(errno));
+    }
+
+    return munmap(data, file_size) == 0 && rc;
+}
+
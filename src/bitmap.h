@@ -0,0 +1,21 @@
+#ifndef __BITMAP_H_
+#define __BITMAP_H_
+
+#include <stdbool.h>
+#include "picture.h"
+
+typedef enum {
+    BITMAP_BMP,
+    BITMAP_TGA
+} BitmapFormat;
+
+/*
+ * Writes a picture as an uncompressed 24-bit BMP or TGA file. The file
+ * is sized up front and mapped, and BGR rows are converted from the
+ * planes right into their place in it, bottom row first.
+ */
+bool bitmap_write(const YCCPicture *picture, const char *path,
+    BitmapFormat format);
+
+#endif
+
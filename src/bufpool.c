@@ -0,0 +1,82 @@
+#include <stdlib.h>
+
+#include "bufpool.h"
+#include "util.h"
+
+// Every block starts with a header that remembers its size, padded so
+// that the data after it stays aligned.
+#define HEADER_SIZE BUFPOOL_ALIGNMENT
+
+static size_t block_size_of(void *block) {
+    return *(size_t *)((char *)block - HEADER_SIZE);
+}
+
+static void block_free(void *block) {
+    free((char *)block - HEADER_SIZE);
+}
+
+static void *block_alloc(size_t size) {
+    size_t total = HEADER_SIZE + size;
+    total = (total + BUFPOOL_ALIGNMENT - 1) / BUFPOOL_ALIGNMENT * BUFPOOL_ALIGNMENT;
+
+    char *base = aligned_alloc(BUFPOOL_ALIGNMENT, total);
+    if (!base) {
+        return NULL;
+    }
+
+    *(size_t *)base = size;
+    return base + HEADER_SIZE;
+}
+
+void *bufpool_get(BufPool *self, size_t size) {
+    void *block = NULL;
+
+    pthread_mutex_lock(&self->lock);
+    if (size > self->block_size) {
+        while (self->count > 0) {
+            block_free(self->blocks[--self->count]);
+        }
+        self->block_size = size;
+    } else if (self->count > 0) {
+        block = self->blocks[--self->count];
+    }
+    size = self->block_size;
+    pthread_mutex_unlock(&self->lock);
+
+    if (!block) {
+        block = block_alloc(size);
+        if (!block) {
+            u_error("[bufpool_get] Failed to allocate %zu bytes!", size);
+        }
+    }
+
+    return block;
+}
+
+void bufpool_put(BufPool *self, void *block) {
+    if (!block) {
+        return;
+    }
+
+    pthread_mutex_lock(&self->lock);
+    if (self->count < BUFPOOL_CAPACITY
+        && block_size_of(block) == self->block_size) {
+        self->blocks[self->count++] = block;
+        block = NULL;
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    if (block) {
+        block_free(block);
+    }
+}
+
+void bufpool_drain(BufPool *self) {
+    pthread_mutex_lock(&self->lock);
+    while (self->count > 0) {
+        block_free(self->blocks[--self->count]);
+    }
+    self->block_size = 0;
+    pthread_mutex_unlock(&self->lock);
+}
+
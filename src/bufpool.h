@@ -0,0 +1,29 @@
+#ifndef __BUFPOOL_H_
+#define __BUFPOOL_H_
+
+#include <stddef.h>
+#include <pthread.h>
+
+#define BUFPOOL_CAPACITY    16
+#define BUFPOOL_ALIGNMENT   64
+
+/*
+ * A small free list of 64-byte aligned blocks of one size. The size is
+ * taken from the first request; a bigger request later drops the cached
+ * blocks and makes its size the new one, smaller ones get a whole block.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    void            *blocks[BUFPOOL_CAPACITY];
+    int             count;
+    size_t          block_size;
+} BufPool;
+
+#define BUFPOOL_INITIALIZER { PTHREAD_MUTEX_INITIALIZER, { NULL }, 0, 0 }
+
+void *bufpool_get(BufPool *self, size_t size);
+void bufpool_put(BufPool *self, void *block);
+void bufpool_drain(BufPool *self);
+
+#endif
+
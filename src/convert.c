@@ -0,0 +1,618 @@
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CONV_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * BT.601 studio swing, coefficients scaled by 256:
+ *
+ *     Y  = 16  + ( 66 R + 129 G +  25 B) / 256
+ *     Cb = 128 + (-38 R -  74 G + 112 B) / 256
+ *     Cr = 128 + (112 R -  94 G -  18 B) / 256
+ *
+ * Every intermediate fits in 16 bits, which is what the vector paths
+ * rely on. Results stay within 1 LSB of the floating point formulas.
+ */
+
+#define Y_R     66
+#define Y_G     129
+#define Y_B     25
+#define CB_R    -38
+#define CB_G    -74
+#define CB_B    112
+#define CR_R    112
+#define CR_G    -94
+#define CR_B    -18
+
+/*
+ * The way back is done with 13 fractional bits:
+ *
+ *     R = (298.082 Y + 408.583 Cr) / 256 - 222.921
+ *     G = (298.082 Y - 100.291 Cb - 208.120 Cr) / 256 + 135.576
+ *     B = (298.082 Y + 516.412 Cb) / 256 - 276.836
+ *
+ * Each coefficient still fits a signed 16-bit lane for _mm_madd_epi16.
+ */
+
+#define RGB_SHIFT   13
+#define RGB_Y       9539
+#define R_CR        13075
+#define G_CB        -3209
+#define G_CR        -6660
+#define B_CB        16525
+#define R_BIAS      -1826169
+#define G_BIAS      1110639
+#define B_BIAS      -2267841
+
+typedef void (*RgbToYccRow)(const uint8_t *, uint8_t *, uint8_t *, uint8_t *,
+    int);
+typedef void (*YccToRgbRow)(const uint8_t *, const uint8_t *, const uint8_t *,
+    const uint8_t *, const uint8_t *, uint8_t *, int, bool);
+typedef void (*UpsampleRow)(const uint8_t *, const uint8_t *, uint8_t *, int);
+typedef void (*RgbToYccFullRow)(const uint8_t *, uint8_t *, uint8_t *,
+    uint8_t *, int);
+
+static void rgb_to_ycc_tail(const uint8_t *rgb, uint8_t *luma,
+    uint8_t *cb, uint8_t *cr, int from, int width) {
+    for (int x = from; x < width; x++) {
+        const uint8_t *p = rgb + 3 * x;
+        luma[x] = 16 + ((Y_R * p[0] + Y_G * p[1] + Y_B * p[2]) >> 8);
+    }
+
+    if (!cb) {
+        return;
+    }
+
+    for (int x = from; x < width; x += 4) {
+        const uint8_t *p = rgb + 3 * x;
+        cb[x / 4] = 128 + ((CB_R * p[0] + CB_G * p[1] + CB_B * p[2]) >> 8);
+        cr[x / 4] = 128 + ((CR_R * p[0] + CR_G * p[1] + CR_B * p[2]) >> 8);
+    }
+}
+
+static void rgb_to_ycc_row_scalar(const uint8_t *rgb, uint8_t *luma,
+    uint8_t *cb, uint8_t *cr, int width) {
+    rgb_to_ycc_tail(rgb, luma, cb, cr, 0, width);
+}
+
+static void rgb_to_ycc_full_tail(const uint8_t *rgb, uint8_t *luma,
+    uint8_t *cb, uint8_t *cr, int from, int width) {
+    for (int x = from; x < width; x++) {
+        const uint8_t *p = rgb + 3 * x;
+        luma[x] = 16 + ((Y_R * p[0] + Y_G * p[1] + Y_B * p[2]) >> 8);
+        cb[x] = 128 + ((CB_R * p[0] + CB_G * p[1] + CB_B * p[2]) >> 8);
+        cr[x] = 128 + ((CR_R * p[0] + CR_G * p[1] + CR_B * p[2]) >> 8);
+    }
+}
+
+static void rgb_to_ycc_full_row_scalar(const uint8_t *rgb, uint8_t *luma,
+    uint8_t *cb, uint8_t *cr, int width) {
+    rgb_to_ycc_full_tail(rgb, luma, cb, cr, 0, width);
+}
+
+static inline uint8_t clamp_rgb(int v) {
+    v >>= RGB_SHIFT;
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+static void ycc_to_rgb_tail(const uint8_t *luma,
+    const uint8_t *cb0, const uint8_t *cr0,
+    const uint8_t *cb1, const uint8_t *cr1,
+    uint8_t *rgb, int from, int width, bool bgr) {
+    int last = width / 4 - 1;
+    int r = bgr ? 2 : 0;
+    int b = 2 - r;
+
+    for (int x = from; x < width; x++) {
+        int k = x / 4;
+        int k1 = k < last ? k + 1 : k;
+        int s = x % 4;
+
+        // Both rows are summed, so the weights add up to 8
+        int u = ((cb0[k] + cb1[k]) * (4 - s) + (cb0[k1] + cb1[k1]) * s) >> 3;
+        int v = ((cr0[k] + cr1[k]) * (4 - s) + (cr0[k1] + cr1[k1]) * s) >> 3;
+        int y = RGB_Y * luma[x];
+
+        rgb[3 * x + r] = clamp_rgb(y + R_CR * v + R_BIAS);
+        rgb[3 * x + 1] = clamp_rgb(y + G_CB * u + G_CR * v + G_BIAS);
+        rgb[3 * x + b] = clamp_rgb(y + B_CB * u + B_BIAS);
+    }
+}
+
+static void ycc_to_rgb_row_scalar(const uint8_t *luma,
+    const uint8_t *cb0, const uint8_t *cr0,
+    const uint8_t *cb1, const uint8_t *cr1,
+    uint8_t *rgb, int width, bool bgr) {
+    ycc_to_rgb_tail(luma, cb0, cr0, cb1, cr1, rgb, 0, width, bgr);
+}
+
+static void upsample_tail(const uint8_t *c0, const uint8_t *c1,
+    uint8_t *out, int from, int width) {
+    int last = width / 4 - 1;
+
+    for (int x = from; x < width; x++) {
+        int k = x / 4;
+        int k1 = k < last ? k + 1 : k;
+        int s = x % 4;
+        out[x] = ((c0[k] + c1[k]) * (4 - s) + (c0[k1] + c1[k1]) * s) >> 3;
+    }
+}
+
+static void upsample_row_scalar(const uint8_t *c0, const uint8_t *c1,
+    uint8_t *out, int width) {
+    upsample_tail(c0, c1, out, 0, width);
+}
+
+#ifdef CONV_X86
+
+/*
+ * Splits 32 packed RGB pixels held in v[0..5] into planes: R in v[0..1],
+ * G in v[2..3] and B in v[4..5]. Each layer is a perfect shuffle of the
+ * 96 bytes, which moves byte p to 2p mod 95; five layers move 3i + c
+ * to 32c + i.
+ */
+__attribute__((target("sse2")))
+static inline void deinterleave_rgb32(__m128i v[6]) {
+    for (int layer = 0; layer < 5; layer++) {
+        __m128i t[6];
+        for (int j = 0; j < 3; j++) {
+            t[2 * j] = _mm_unpacklo_epi8(v[j], v[j + 3]);
+            t[2 * j + 1] = _mm_unpackhi_epi8(v[j], v[j + 3]);
+        }
+        for (int j = 0; j < 6; j++) {
+            v[j] = t[j];
+        }
+    }
+}
+
+__attribute__((target("sse2")))
+static inline void load_rgb32(const uint8_t *rgb, __m128i v[6]) {
+    for (int j = 0; j < 6; j++) {
+        v[j] = _mm_loadu_si128((const __m128i *)(rgb + 16 * j));
+    }
+    deinterleave_rgb32(v);
+}
+
+// Picks pixels 0, 4, ... 28 out of a channel split over two registers.
+__attribute__((target("sse2")))
+static inline __m128i every_4th(__m128i lo, __m128i hi) {
+    const __m128i mask = _mm_set1_epi32(0xFF);
+    return _mm_packs_epi32(_mm_and_si128(lo, mask), _mm_and_si128(hi, mask));
+}
+
+// Cb and Cr of 8 pixels whose channels are widened to 16 bits.
+__attribute__((target("sse2")))
+static inline void chroma8(__m128i r, __m128i g, __m128i b,
+    __m128i *u, __m128i *w) {
+    __m128i bias = _mm_set1_epi16(128);
+
+    *u = _mm_add_epi16(_mm_add_epi16(
+        _mm_mullo_epi16(r, _mm_set1_epi16(CB_R)),
+        _mm_mullo_epi16(g, _mm_set1_epi16(CB_G))),
+        _mm_mullo_epi16(b, _mm_set1_epi16(CB_B)));
+    *w = _mm_add_epi16(_mm_add_epi16(
+        _mm_mullo_epi16(r, _mm_set1_epi16(CR_R)),
+        _mm_mullo_epi16(g, _mm_set1_epi16(CR_G))),
+        _mm_mullo_epi16(b, _mm_set1_epi16(CR_B)));
+
+    *u = _mm_add_epi16(_mm_srai_epi16(*u, 8), bias);
+    *w = _mm_add_epi16(_mm_srai_epi16(*w, 8), bias);
+}
+
+__attribute__((target("sse2")))
+static inline void store_chroma8(const __m128i v[6], uint8_t *cb,
+    uint8_t *cr) {
+    __m128i u, w;
+    chroma8(every_4th(v[0], v[1]), every_4th(v[2], v[3]),
+        every_4th(v[4], v[5]), &u, &w);
+
+    _mm_storel_epi64((__m128i *)cb, _mm_packus_epi16(u, u));
+    _mm_storel_epi64((__m128i *)cr, _mm_packus_epi16(w, w));
+}
+
+// Luma of 8 pixels whose channels are widened to 16 bits.
+__attribute__((target("sse2")))
+static inline __m128i luma8(__m128i r, __m128i g, __m128i b) {
+    __m128i y = _mm_add_epi16(_mm_add_epi16(
+        _mm_mullo_epi16(r, _mm_set1_epi16(Y_R)),
+        _mm_mullo_epi16(g, _mm_set1_epi16(Y_G))),
+        _mm_mullo_epi16(b, _mm_set1_epi16(Y_B)));
+    return _mm_add_epi16(_mm_srli_epi16(y, 8), _mm_set1_epi16(16));
+}
+
+__attribute__((target("sse2")))
+static void rgb_to_ycc_row_sse2(const uint8_t *rgb, uint8_t *luma,
+    uint8_t *cb, uint8_t *cr, int width) {
+    const __m128i zero = _mm_setzero_si128();
+    int x;
+
+    for (x = 0; x + 32 <= width; x += 32) {
+        __m128i v[6];
+        load_rgb32(rgb + 3 * x, v);
+
+        for (int h = 0; h < 2; h++) {
+            __m128i r = v[h], g = v[2 + h], b = v[4 + h];
+            __m128i lo = luma8(_mm_unpacklo_epi8(r, zero),
+                _mm_unpacklo_epi8(g, zero), _mm_unpacklo_epi8(b, zero));
+            __m128i hi = luma8(_mm_unpackhi_epi8(r, zero),
+                _mm_unpackhi_epi8(g, zero), _mm_unpackhi_epi8(b, zero));
+            _mm_storeu_si128((__m128i *)(luma + x + 16 * h),
+                _mm_packus_epi16(lo, hi));
+        }
+
+        if (cb) {
+            store_chroma8(v, cb + x / 4, cr + x / 4);
+        }
+    }
+
+    rgb_to_ycc_tail(rgb, luma, cb, cr, x, width);
+}
+
+__attribute__((target("sse2")))
+static void rgb_to_ycc_full_row_sse2(const uint8_t *rgb, uint8_t *luma,
+    uint8_t *cb, uint8_t *cr, int width) {
+    const __m128i zero = _mm_setzero_si128();
+    int x;
+
+    for (x = 0; x + 32 <= width; x += 32) {
+        __m128i v[6];
+        load_rgb32(rgb + 3 * x, v);
+
+        for (int h = 0; h < 2; h++) {
+            __m128i r = v[h], g = v[2 + h], b = v[4 + h];
+            __m128i r0 = _mm_unpacklo_epi8(r, zero);
+            __m128i g0 = _mm_unpacklo_epi8(g, zero);
+            __m128i b0 = _mm_unpacklo_epi8(b, zero);
+            __m128i r1 = _mm_unpackhi_epi8(r, zero);
+            __m128i g1 = _mm_unpackhi_epi8(g, zero);
+            __m128i b1 = _mm_unpackhi_epi8(b, zero);
+            __m128i u0, w0, u1, w1;
+
+            chroma8(r0, g0, b0, &u0, &w0);
+            chroma8(r1, g1, b1, &u1, &w1);
+
+            _mm_storeu_si128((__m128i *)(luma + x + 16 * h),
+                _mm_packus_epi16(luma8(r0, g0, b0), luma8(r1, g1, b1)));
+            _mm_storeu_si128((__m128i *)(cb + x + 16 * h),
+                _mm_packus_epi16(u0, u1));
+            _mm_storeu_si128((__m128i *)(cr + x + 16 * h),
+                _mm_packus_epi16(w0, w1));
+        }
+    }
+
+    rgb_to_ycc_full_tail(rgb, luma, cb, cr, x, width);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i luma16(__m128i r, __m128i g, __m128i b) {
+    __m256i y = _mm256_add_epi16(_mm256_add_epi16(
+        _mm256_mullo_epi16(_mm256_cvtepu8_epi16(r), _mm256_set1_epi16(Y_R)),
+        _mm256_mullo_epi16(_mm256_cvtepu8_epi16(g), _mm256_set1_epi16(Y_G))),
+        _mm256_mullo_epi16(_mm256_cvtepu8_epi16(b), _mm256_set1_epi16(Y_B)));
+    return _mm256_add_epi16(_mm256_srli_epi16(y, 8), _mm256_set1_epi16(16));
+}
+
+__attribute__((target("avx2")))
+static void rgb_to_ycc_row_avx2(const uint8_t *rgb, uint8_t *luma,
+    uint8_t *cb, uint8_t *cr, int width) {
+    int x;
+
+    for (x = 0; x + 32 <= width; x += 32) {
+        __m128i v[6];
+        load_rgb32(rgb + 3 * x, v);
+
+        __m256i lo = luma16(v[0], v[2], v[4]);
+        __m256i hi = luma16(v[1], v[3], v[5]);
+        __m256i y = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi),
+            _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i *)(luma + x), y);
+
+        if (cb) {
+            store_chroma8(v, cb + x / 4, cr + x / 4);
+        }
+    }
+
+    rgb_to_ycc_tail(rgb, luma, cb, cr, x, width);
+}
+
+/*
+ * The inverse of deinterleave_rgb32: five layers of taking even and odd
+ * bytes turn planes in v[0..5] back into 96 bytes of packed RGB.
+ */
+__attribute__((target("sse2")))
+static inline void interleave_rgb32(__m128i v[6]) {
+    const __m128i low = _mm_set1_epi16(0xFF);
+
+    for (int layer = 0; layer < 5; layer++) {
+        __m128i t[6];
+        for (int j = 0; j < 3; j++) {
+            __m128i a = v[2 * j], b = v[2 * j + 1];
+            t[j] = _mm_packus_epi16(_mm_and_si128(a, low),
+                _mm_and_si128(b, low));
+            t[j + 3] = _mm_packus_epi16(_mm_srli_epi16(a, 8),
+                _mm_srli_epi16(b, 8));
+        }
+        for (int j = 0; j < 6; j++) {
+            v[j] = t[j];
+        }
+    }
+}
+
+/*
+ * Upsamples 8 chroma samples of two rows into 32 pixels, split into
+ * out[0..3] by 8 pixels. Reads one sample past the 8th.
+ */
+__attribute__((target("sse2")))
+static inline void upsample_chroma32(const uint8_t *c0, const uint8_t *c1,
+    __m128i out[4]) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i wa = _mm_setr_epi16(4, 3, 2, 1, 4, 3, 2, 1);
+    const __m128i wb = _mm_setr_epi16(0, 1, 2, 3, 0, 1, 2, 3);
+
+    __m128i a = _mm_add_epi16(
+        _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)c0), zero),
+        _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)c1), zero));
+    __m128i b = _mm_add_epi16(
+        _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(c0 + 1)), zero),
+        _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(c1 + 1)), zero));
+
+    __m128i a01 = _mm_unpacklo_epi16(a, a), a23 = _mm_unpackhi_epi16(a, a);
+    __m128i b01 = _mm_unpacklo_epi16(b, b), b23 = _mm_unpackhi_epi16(b, b);
+    __m128i a4[4] = {
+        _mm_unpacklo_epi32(a01, a01), _mm_unpackhi_epi32(a01, a01),
+        _mm_unpacklo_epi32(a23, a23), _mm_unpackhi_epi32(a23, a23)
+    };
+    __m128i b4[4] = {
+        _mm_unpacklo_epi32(b01, b01), _mm_unpackhi_epi32(b01, b01),
+        _mm_unpacklo_epi32(b23, b23), _mm_unpackhi_epi32(b23, b23)
+    };
+
+    for (int i = 0; i < 4; i++) {
+        out[i] = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(a4[i], wa),
+            _mm_mullo_epi16(b4[i], wb)), 3);
+    }
+}
+
+__attribute__((target("sse2")))
+static void upsample_row_sse2(const uint8_t *c0, const uint8_t *c1,
+    uint8_t *out, int width) {
+    int x;
+
+    for (x = 0; x + 36 <= width; x += 32) {
+        __m128i c[4];
+        upsample_chroma32(c0 + x / 4, c1 + x / 4, c);
+        _mm_storeu_si128((__m128i *)(out + x), _mm_packus_epi16(c[0], c[1]));
+        _mm_storeu_si128((__m128i *)(out + x + 16),
+            _mm_packus_epi16(c[2], c[3]));
+    }
+
+    upsample_tail(c0, c1, out, x, width);
+}
+
+// R, G and B of 8 pixels as 16-bit lanes, not yet clamped.
+__attribute__((target("sse2")))
+static inline void ycc_to_rgb8(__m128i y, __m128i u, __m128i v,
+    __m128i *r, __m128i *g, __m128i *b) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i k_r = _mm_setr_epi16(RGB_Y, R_CR, RGB_Y, R_CR,
+        RGB_Y, R_CR, RGB_Y, R_CR);
+    const __m128i k_gy = _mm_setr_epi16(RGB_Y, G_CR, RGB_Y, G_CR,
+        RGB_Y, G_CR, RGB_Y, G_CR);
+    const __m128i k_gu = _mm_setr_epi16(G_CB, 0, G_CB, 0, G_CB, 0, G_CB, 0);
+    const __m128i k_b = _mm_setr_epi16(RGB_Y, B_CB, RGB_Y, B_CB,
+        RGB_Y, B_CB, RGB_Y, B_CB);
+    __m128i yv[2] = { _mm_unpacklo_epi16(y, v), _mm_unpackhi_epi16(y, v) };
+    __m128i yu[2] = { _mm_unpacklo_epi16(y, u), _mm_unpackhi_epi16(y, u) };
+    __m128i uz[2] = { _mm_unpacklo_epi16(u, zero), _mm_unpackhi_epi16(u, zero) };
+    __m128i rr[2], gg[2], bb[2];
+
+    for (int h = 0; h < 2; h++) {
+        rr[h] = _mm_add_epi32(_mm_madd_epi16(yv[h], k_r),
+            _mm_set1_epi32(R_BIAS));
+        gg[h] = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(yv[h], k_gy),
+            _mm_madd_epi16(uz[h], k_gu)), _mm_set1_epi32(G_BIAS));
+        bb[h] = _mm_add_epi32(_mm_madd_epi16(yu[h], k_b),
+            _mm_set1_epi32(B_BIAS));
+    }
+
+    *r = _mm_packs_epi32(_mm_srai_epi32(rr[0], RGB_SHIFT),
+        _mm_srai_epi32(rr[1], RGB_SHIFT));
+    *g = _mm_packs_epi32(_mm_srai_epi32(gg[0], RGB_SHIFT),
+        _mm_srai_epi32(gg[1], RGB_SHIFT));
+    *b = _mm_packs_epi32(_mm_srai_epi32(bb[0], RGB_SHIFT),
+        _mm_srai_epi32(bb[1], RGB_SHIFT));
+}
+
+__attribute__((target("sse2")))
+static void ycc_to_rgb_row_sse2(const uint8_t *luma,
+    const uint8_t *cb0, const uint8_t *cr0,
+    const uint8_t *cb1, const uint8_t *cr1,
+    uint8_t *rgb, int width, bool bgr) {
+    int r_plane = bgr ? 4 : 0;
+    const __m128i zero = _mm_setzero_si128();
+    int x;
+
+    // The upsampler peeks at the sample after the last one it expands
+    for (x = 0; x + 36 <= width; x += 32) {
+        __m128i u[4], v[4], p[6];
+        __m128i r[4], g[4], b[4];
+
+        upsample_chroma32(cb0 + x / 4, cb1 + x / 4, u);
+        upsample_chroma32(cr0 + x / 4, cr1 + x / 4, v);
+
+        for (int h = 0; h < 2; h++) {
+            __m128i y = _mm_loadu_si128((const __m128i *)(luma + x + 16 * h));
+            ycc_to_rgb8(_mm_unpacklo_epi8(y, zero), u[2 * h], v[2 * h],
+                &r[2 * h], &g[2 * h], &b[2 * h]);
+            ycc_to_rgb8(_mm_unpackhi_epi8(y, zero), u[2 * h + 1],
+                v[2 * h + 1], &r[2 * h + 1], &g[2 * h + 1], &b[2 * h + 1]);
+        }
+
+        for (int h = 0; h < 2; h++) {
+            p[r_plane + h] = _mm_packus_epi16(r[2 * h], r[2 * h + 1]);
+            p[2 + h] = _mm_packus_epi16(g[2 * h], g[2 * h + 1]);
+            p[4 - r_plane + h] = _mm_packus_epi16(b[2 * h], b[2 * h + 1]);
+        }
+
+        interleave_rgb32(p);
+        for (int j = 0; j < 6; j++) {
+            _mm_storeu_si128((__m128i *)(rgb + 3 * x + 16 * j), p[j]);
+        }
+    }
+
+    ycc_to_rgb_tail(luma, cb0, cr0, cb1, cr1, rgb, x, width, bgr);
+}
+
+// Same as ycc_to_rgb8, for 16 pixels.
+__attribute__((target("avx2")))
+static inline __m256i ycc_to_rgb16(__m256i y, __m256i u, __m256i v,
+    int channel) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i lo, hi;
+
+    if (channel == 0) {
+        const __m256i k = _mm256_set1_epi32(
+            (uint16_t)RGB_Y | ((uint32_t)(uint16_t)R_CR << 16));
+        lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(y, v), k);
+        hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(y, v), k);
+        lo = _mm256_add_epi32(lo, _mm256_set1_epi32(R_BIAS));
+        hi = _mm256_add_epi32(hi, _mm256_set1_epi32(R_BIAS));
+    } else if (channel == 1) {
+        const __m256i ky = _mm256_set1_epi32(
+            (uint16_t)RGB_Y | ((uint32_t)(uint16_t)G_CR << 16));
+        const __m256i ku = _mm256_set1_epi32((uint16_t)G_CB);
+        lo = _mm256_add_epi32(
+            _mm256_madd_epi16(_mm256_unpacklo_epi16(y, v), ky),
+            _mm256_madd_epi16(_mm256_unpacklo_epi16(u, zero), ku));
+        hi = _mm256_add_epi32(
+            _mm256_madd_epi16(_mm256_unpackhi_epi16(y, v), ky),
+            _mm256_madd_epi16(_mm256_unpackhi_epi16(u, zero), ku));
+        lo = _mm256_add_epi32(lo, _mm256_set1_epi32(G_BIAS));
+        hi = _mm256_add_epi32(hi, _mm256_set1_epi32(G_BIAS));
+    } else {
+        const __m256i k = _mm256_set1_epi32(
+            (uint16_t)RGB_Y | ((uint32_t)(uint16_t)B_CB << 16));
+        lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(y, u), k);
+        hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(y, u), k);
+        lo = _mm256_add_epi32(lo, _mm256_set1_epi32(B_BIAS));
+        hi = _mm256_add_epi32(hi, _mm256_set1_epi32(B_BIAS));
+    }
+
+    // Unpacking and packing within the same lanes keeps pixel order
+    return _mm256_packs_epi32(_mm256_srai_epi32(lo, RGB_SHIFT),
+        _mm256_srai_epi32(hi, RGB_SHIFT));
+}
+
+__attribute__((target("avx2")))
+static void ycc_to_rgb_row_avx2(const uint8_t *luma,
+    const uint8_t *cb0, const uint8_t *cr0,
+    const uint8_t *cb1, const uint8_t *cr1,
+    uint8_t *rgb, int width, bool bgr) {
+    int x;
+
+    for (x = 0; x + 36 <= width; x += 32) {
+        __m128i u4[4], v4[4], p[6];
+        __m256i c[3][2];
+
+        upsample_chroma32(cb0 + x / 4, cb1 + x / 4, u4);
+        upsample_chroma32(cr0 + x / 4, cr1 + x / 4, v4);
+
+        for (int h = 0; h < 2; h++) {
+            __m256i y = _mm256_cvtepu8_epi16(
+                _mm_loadu_si128((const __m128i *)(luma + x + 16 * h)));
+            __m256i u = _mm256_set_m128i(u4[2 * h + 1], u4[2 * h]);
+            __m256i v = _mm256_set_m128i(v4[2 * h + 1], v4[2 * h]);
+
+            for (int ch = 0; ch < 3; ch++) {
+                c[ch][h] = ycc_to_rgb16(y, u, v, ch);
+            }
+        }
+
+        for (int ch = 0; ch < 3; ch++) {
+            int plane = bgr ? 2 - ch : ch;
+            __m256i packed = _mm256_permute4x64_epi64(
+                _mm256_packus_epi16(c[ch][0], c[ch][1]),
+                _MM_SHUFFLE(3, 1, 2, 0));
+            p[2 * plane] = _mm256_castsi256_si128(packed);
+            p[2 * plane + 1] = _mm256_extracti128_si256(packed, 1);
+        }
+
+        interleave_rgb32(p);
+        for (int j = 0; j < 6; j++) {
+            _mm_storeu_si128((__m128i *)(rgb + 3 * x + 16 * j), p[j]);
+        }
+    }
+
+    ycc_to_rgb_tail(luma, cb0, cr0, cb1, cr1, rgb, x, width, bgr);
+}
+
+#endif
+
+static RgbToYccRow rgb_to_ycc_row;
+static YccToRgbRow ycc_to_rgb_row;
+static UpsampleRow upsample_row;
+static RgbToYccFullRow rgb_to_ycc_full_row;
+static pthread_once_t selected = PTHREAD_ONCE_INIT;
+
+static void conv_select(void) {
+    rgb_to_ycc_row = rgb_to_ycc_row_scalar;
+    ycc_to_rgb_row = ycc_to_rgb_row_scalar;
+    upsample_row = upsample_row_scalar;
+    rgb_to_ycc_full_row = rgb_to_ycc_full_row_scalar;
+
+#ifdef CONV_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        rgb_to_ycc_row = rgb_to_ycc_row_avx2;
+        ycc_to_rgb_row = ycc_to_rgb_row_avx2;
+        upsample_row = upsample_row_sse2;
+        rgb_to_ycc_full_row = rgb_to_ycc_full_row_sse2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        rgb_to_ycc_row = rgb_to_ycc_row_sse2;
+        ycc_to_rgb_row = ycc_to_rgb_row_sse2;
+        upsample_row = upsample_row_sse2;
+        rgb_to_ycc_full_row = rgb_to_ycc_full_row_sse2;
+    }
+#endif
+}
+
+void conv_rgb_to_ycc_row(const uint8_t *rgb, uint8_t *luma,
+    uint8_t *cb, uint8_t *cr, int width) {
+    pthread_once(&selected, conv_select);
+    rgb_to_ycc_row(rgb, luma, cb, cr, width);
+}
+
+void conv_ycc_to_rgb_row(const uint8_t *luma,
+    const uint8_t *cb0, const uint8_t *cr0,
+    const uint8_t *cb1, const uint8_t *cr1,
+    uint8_t *rgb, int width) {
+    pthread_once(&selected, conv_select);
+    ycc_to_rgb_row(luma, cb0, cr0, cb1, cr1, rgb, width, false);
+}
+
+void conv_ycc_to_bgr_row(const uint8_t *luma,
+    const uint8_t *cb0, const uint8_t *cr0,
+    const uint8_t *cb1, const uint8_t *cr1,
+    uint8_t *bgr, int width) {
+    pthread_once(&selected, conv_select);
+    ycc_to_rgb_row(luma, cb0, cr0, cb1, cr1, bgr, width, true);
+}
+
+void conv_upsample_chroma_row(const uint8_t *c0, const uint8_t *c1,
+    uint8_t *out, int width) {
+    pthread_once(&selected, conv_select);
+    upsample_row(c0, c1, out, width);
+}
+
+void conv_rgb_to_ycc_full_row(const uint8_t *rgb, uint8_t *luma,
+    uint8_t *cb, uint8_t *cr, int width) {
+    pthread_once(&selected, conv_select);
+    rgb_to_ycc_full_row(rgb, luma, cb, cr, width);
+}
+
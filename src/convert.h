@@ -0,0 +1,40 @@
+#ifndef __CONVERT_H_
+#define __CONVERT_H_
+
+#include <stdint.h>
+
+/*
+ * Fixed-point colour conversion kernels. The best implementation for
+ * the running CPU is picked on the first call.
+ */
+
+// Converts `width` packed RGB pixels to luma. When `cb` and `cr` are
+// given, the chroma of every 4th pixel is stored there as well.
+void conv_rgb_to_ycc_row(const uint8_t *rgb, uint8_t *luma,
+    uint8_t *cb, uint8_t *cr, int width);
+
+// Same as conv_rgb_to_ycc_row, but with chroma of every pixel.
+void conv_rgb_to_ycc_full_row(const uint8_t *rgb, uint8_t *luma,
+    uint8_t *cb, uint8_t *cr, int width);
+
+// Converts `width` pixels to packed RGB. Chroma is interpolated linearly
+// between 4-pixel-wide samples and between the `cb0`/`cr0` row and the
+// `cb1`/`cr1` row; pass the same row twice to use it alone.
+void conv_ycc_to_rgb_row(const uint8_t *luma,
+    const uint8_t *cb0, const uint8_t *cr0,
+    const uint8_t *cb1, const uint8_t *cr1,
+    uint8_t *rgb, int width);
+
+// Same as conv_ycc_to_rgb_row, with the channels in B, G, R order.
+void conv_ycc_to_bgr_row(const uint8_t *luma,
+    const uint8_t *cb0, const uint8_t *cr0,
+    const uint8_t *cb1, const uint8_t *cr1,
+    uint8_t *bgr, int width);
+
+// Interpolates one row of chroma to `width` pixels, the same way
+// conv_ycc_to_rgb_row does.
+void conv_upsample_chroma_row(const uint8_t *c0, const uint8_t *c1,
+    uint8_t *out, int width);
+
+#endif
+
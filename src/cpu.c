@@ -0,0 +1,191 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "cpu.h"
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+#define DEFAULT_L2  (256 * 1024)
+
+static int affinity_cpus(void) {
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        return CPU_COUNT(&set);
+    }
+    return sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+// Turns a quota and a period into whole CPUs, 0 if there is no limit.
+static int quota_cpus(long long quota, long long period) {
+    if (quota <= 0 || period <= 0) {
+        return 0;
+    }
+
+    int cpus = quota / period;
+    return cpus < 1 ? 1 : cpus;
+}
+
+// cgroup v2: "<quota|max> <period>" in cpu.max
+static int cgroup2_cpus(const char *path) {
+    char file_name[1024];
+    char quota[32];
+    long long period;
+    int cpus = 0;
+
+    snprintf(file_name, sizeof(file_name), CGROUP_ROOT "%s/cpu.max", path);
+    FILE *file = fopen(file_name, "r");
+    if (!file) {
+        return -1;
+    }
+
+    if (fscanf(file, "%31s %lld", quota, &period) == 2
+        && strcmp(quota, "max") != 0) {
+        cpus = quota_cpus(atoll(quota), period);
+    }
+
+    fclose(file);
+    return cpus;
+}
+
+// cgroup v1: cpu.cfs_quota_us and cpu.cfs_period_us in the cpu hierarchy
+static int cgroup1_cpus(const char *mount, const char *path) {
+    char file_name[1024];
+    long long quota = 0;
+    long long period = 0;
+    FILE *file;
+
+    snprintf(file_name, sizeof(file_name), CGROUP_ROOT "/%s%s/cpu.cfs_quota_us",
+        mount, path);
+    if (!(file = fopen(file_name, "r"))) {
+        return -1;
+    }
+    if (fscanf(file, "%lld", &quota) != 1) {
+        quota = 0;
+    }
+    fclose(file);
+
+    snprintf(file_name, sizeof(file_name), CGROUP_ROOT "/%s%s/cpu.cfs_period_us",
+        mount, path);
+    if (!(file = fopen(file_name, "r"))) {
+        return -1;
+    }
+    if (fscanf(file, "%lld", &period) != 1) {
+        period = 0;
+    }
+    fclose(file);
+
+    return quota_cpus(quota, period);
+}
+
+// Looks the cgroup of this process up in /proc/self/cgroup. Inside a
+// container the path is usually not visible, so the root is tried too.
+static int cgroup_cpus(void) {
+    FILE *file = fopen("/proc/self/cgroup", "r");
+    if (!file) {
+        return 0;
+    }
+
+    char line[1024];
+    int cpus = -1;
+
+    while (cpus < 0 && fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\n")] = '\0';
+
+        // "<id>:<controllers>:<path>"
+        char *controllers = strchr(line, ':');
+        char *path = controllers ? strchr(controllers + 1, ':') : NULL;
+        if (!path) {
+            continue;
+        }
+        *path++ = '\0';
+        controllers++;
+        if (strcmp(path, "/") == 0) {
+            path = "";
+        }
+
+        if (*controllers == '\0') {
+            cpus = cgroup2_cpus(path);
+            if (cpus < 0) {
+                cpus = cgroup2_cpus("");
+            }
+            continue;
+        }
+
+        char *save;
+        for (char *name = strtok_r(controllers, ",", &save); name;
+            name = strtok_r(NULL, ",", &save)) {
+            if (strcmp(name, "cpu") != 0) {
+                continue;
+            }
+
+            const char *mounts[] = { "cpu", "cpu,cpuacct", "cpuacct,cpu" };
+            for (int i = 0; cpus < 0 && i < 3; i++) {
+                cpus = cgroup1_cpus(mounts[i], path);
+                if (cpus < 0) {
+                    cpus = cgroup1_cpus(mounts[i], "");
+                }
+            }
+        }
+    }
+
+    fclose(file);
+    return cpus < 0 ? 0 : cpus;
+}
+
+int cpu_budget(void) {
+    int cpus = affinity_cpus();
+    int quota = cgroup_cpus();
+
+    if (quota > 0 && quota < cpus) {
+        cpus = quota;
+    }
+
+    return cpus < 1 ? 1 : cpus;
+}
+
+size_t cpu_l2_size(void) {
+    long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    return size > 0 ? (size_t)size : DEFAULT_L2;
+}
+
+int cpu_parse_list(const char *list, int *cpus, int max) {
+    int count = 0;
+    const char *p = list;
+
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p || first < 0) {
+            return -1;
+        }
+        p = end;
+
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first) {
+                return -1;
+            }
+            p = end;
+        }
+
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (count == max) {
+                return -1;
+            }
+            cpus[count++] = cpu;
+        }
+
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0') {
+            return -1;
+        }
+    }
+
+    return count;
+}
+
@@ -0,0 +1,20 @@
+#ifndef __CPU_H_
+#define __CPU_H_
+
+#include <stddef.h>
+
+#define CPU_LIST_MAX    1024
+
+// Count of CPUs this process may really use: the CPUs in its affinity
+// mask, cut down to the CFS quota of its cgroup (v1 or v2) if it has one.
+int cpu_budget(void);
+
+// Size of the L2 cache in bytes, or a guess if the system won't tell.
+size_t cpu_l2_size(void);
+
+// Parses a list like "0,2,4-7" into `cpus`. Returns the count of CPUs
+// in it, or -1 if the list is malformed.
+int cpu_parse_list(const char *list, int *cpus, int max);
+
+#endif
+
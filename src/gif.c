@@ -0,0 +1,371 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "gif.h"
+#include "convert.h"
+#include "tpool.h"
+#include "cpu.h"
+#include "util.h"
+
+#define GIF_TRANSPARENT     GIF_COLORS
+#define GIF_DISPOSE_NONE    1 // leave the frame for the next one to cover
+
+#define LZW_MIN_BITS        8
+#define LZW_MAX_BITS        12
+#define LZW_CLEAR           (1 << LZW_MIN_BITS)
+#define LZW_END             (LZW_CLEAR + 1)
+#define LZW_LAST_CODE       ((1 << LZW_MAX_BITS) - 1)
+#define LZW_HASH_BITS       13 // twice as many slots as codes
+
+typedef struct {
+    GifWriter           *writer;
+    const YCCPicture    *picture;
+    bool                convert; // picture to `rgb`
+    bool                map; // `rgb` to `current`, noting what changed
+    bool                whole; // nothing came before, every pixel is new
+    int                 strip_rows;
+} GifJob;
+
+// Box of a frame to be stored
+typedef struct {
+    int         x;
+    int         y;
+    int         width;
+    int         height;
+} GifBox;
+
+// Codes packed from the least significant bit on, in blocks of 255 bytes
+typedef struct {
+    FILE        *file;
+    uint32_t    bits;
+    int         bit_count;
+    int         length;
+    uint8_t     block[256]; // the length, then the data
+} GifBits;
+
+GifWriter *gif_writer_new(const char *path, int width, int height, int fps) {
+    if (width > 0xFFFF || height > 0xFFFF) {
+        u_error("[gif_writer_new] GIF can't be %dx%d.", width, height);
+        return NULL;
+    }
+
+    GifWriter *self = calloc(1, sizeof(GifWriter));
+    if (!self) {
+        u_error("[gif_writer_new] Failed to allocate GifWriter structure.");
+        return NULL;
+    }
+
+    size_t pixels = (size_t)width * height;
+    self->width = width;
+    self->height = height;
+    self->fps = fps;
+    self->rgb = malloc(pixels * 3);
+    self->previous = malloc(pixels);
+    self->current = malloc(pixels);
+    self->extents = malloc(sizeof(int) * 2 * height);
+    self->lzw_keys = malloc(sizeof(uint32_t) << LZW_HASH_BITS);
+    self->lzw_codes = malloc(sizeof(uint16_t) << LZW_HASH_BITS);
+    if (!self->rgb || !self->previous || !self->current || !self->extents
+        || !self->lzw_keys || !self->lzw_codes) {
+        u_error("[gif_writer_new] Failed to allocate frame buffers.");
+        gif_writer_close(&self);
+        return NULL;
+    }
+
+    self->file = fopen(path, "wb");
+    if (!self->file) {
+        u_error("Unable to open \"%s\" for write.", path);
+        gif_writer_close(&self);
+        return NULL;
+    }
+
+    return self;
+}
+
+// The header can only go out with the palette, made from the first frame.
+static void gif_header(GifWriter *self) {
+    uint8_t header[13 + 3 * 256 + 19] = { 'G', 'I', 'F', '8', '9', 'a' };
+    uint8_t *p = u_put_le16(header + 6, self->width);
+
+    p = u_put_le16(p, self->height);
+    *p++ = 0xF7; // global palette of 256 colours, 8 bits each
+    *p++ = 0; // background
+    *p++ = 0; // square pixels
+
+    memcpy(p, self->quant->palette, 3 * self->quant->count);
+    p += 3 * 256;
+
+    // Loop forever
+    memcpy(p, "\x21\xFF\x0BNETSCAPE2.0\x03\x01\x00\x00\x00", 19);
+
+    fwrite(header, 1, sizeof(header), self->file);
+}
+
+void gif_frame_strip(void *ctx, int strip) {
+    GifJob *job = ctx;
+    GifWriter *writer = job->writer;
+    const YCCPicture *self = job->picture;
+    int chroma_width = self->width / 4;
+    int first = strip * job->strip_rows;
+    int last = first + job->strip_rows;
+    if (last > self->height) {
+        last = self->height;
+    }
+
+    for (int y = first; y < last; y++) {
+        uint8_t *rgb = writer->rgb + (size_t)y * self->width * 3;
+
+        if (job->convert) {
+            // Chroma rows are picked as ycc_to_rgb does
+            int top = (y / 2) * chroma_width;
+            int bottom = (y % 2 == 1 && y < self->height - 1)
+                ? top + chroma_width
+                : top;
+
+            conv_ycc_to_rgb_row(self->luma + y * self->width,
+                self->cb + top, self->cr + top,
+                self->cb + bottom, self->cr + bottom,
+                rgb, self->width);
+        }
+        if (!job->map) {
+            continue;
+        }
+
+        uint8_t *now = writer->current + (size_t)y * self->width;
+        const uint8_t *was = writer->previous + (size_t)y * self->width;
+        int *extent = writer->extents + 2 * y;
+
+        quant_map_row(writer->quant, rgb, now, self->width);
+
+        if (job->whole) {
+            extent[0] = 0;
+            extent[1] = self->width - 1;
+        } else if (memcmp(now, was, self->width) == 0) {
+            extent[0] = -1;
+        } else {
+            int left = 0;
+            int right = self->width - 1;
+            while (now[left] == was[left]) {
+                left++;
+            }
+            while (now[right] == was[right]) {
+                right--;
+            }
+            extent[0] = left;
+            extent[1] = right;
+        }
+    }
+}
+
+// Finds the box around all changed pixels. An unchanged frame still
+// needs one, so it gets a single transparent pixel.
+static GifBox gif_find_box(const GifWriter *self) {
+    GifBox box = { 0, 0, 1, 1 };
+    int left = self->width;
+    int right = -1;
+    int top = -1;
+    int bottom = -1;
+
+    for (int y = 0; y < self->height; y++) {
+        const int *extent = self->extents + 2 * y;
+        if (extent[0] < 0) {
+            continue;
+        }
+        if (top < 0) {
+            top = y;
+        }
+        bottom = y;
+        if (extent[0] < left) {
+            left = extent[0];
+        }
+        if (extent[1] > right) {
+            right = extent[1];
+        }
+    }
+
+    if (top >= 0) {
+        box.x = left;
+        box.y = top;
+        box.width = right - left + 1;
+        box.height = bottom - top + 1;
+    }
+
+    return box;
+}
+
+static void gif_put_code(GifBits *out, int code, int size) {
+    out->bits |= (uint32_t)code << out->bit_count;
+    out->bit_count += size;
+
+    while (out->bit_count >= 8) {
+        out->block[1 + out->length++] = out->bits & 0xFF;
+        out->bits >>= 8;
+        out->bit_count -= 8;
+
+        if (out->length == 255) {
+            out->block[0] = out->length;
+            fwrite(out->block, 1, out->length + 1, out->file);
+            out->length = 0;
+        }
+    }
+}
+
+static void gif_end_bits(GifBits *out) {
+    if (out->bit_count > 0) {
+        gif_put_code(out, 0, 8 - out->bit_count);
+    }
+    if (out->length > 0) {
+        out->block[0] = out->length;
+        fwrite(out->block, 1, out->length + 1, out->file);
+    }
+    fputc(0, out->file);
+}
+
+/*
+ * LZW of the box, its pixels that didn't change being transparent. The
+ * string table is a hash of (prefix code, pixel) pairs, and starts over
+ * with a clear code once all 12-bit codes are taken. Code size grows as
+ * soon as the last code given out no longer fits, which is the same
+ * point where a decoder, one code behind, grows it too.
+ */
+static void gif_encode(GifWriter *self, const GifBox *box, bool whole) {
+    const uint32_t mask = (1 << LZW_HASH_BITS) - 1;
+    GifBits out = { .file = self->file };
+    int size = LZW_MIN_BITS + 1;
+    int last = LZW_END;
+    int prefix = -1;
+
+    fputc(LZW_MIN_BITS, self->file);
+    memset(self->lzw_keys, 0, sizeof(uint32_t) << LZW_HASH_BITS);
+    gif_put_code(&out, LZW_CLEAR, size);
+
+    for (int y = box->y; y < box->y + box->height; y++) {
+        size_t row = (size_t)y * self->width;
+        const uint8_t *now = self->current + row;
+        const uint8_t *was = self->previous + row;
+
+        for (int x = box->x; x < box->x + box->width; x++) {
+            int pixel = whole || now[x] != was[x]
+                ? now[x]
+                : GIF_TRANSPARENT;
+            if (prefix < 0) {
+                prefix = pixel;
+                continue;
+            }
+
+            // Keys are off by one, so that zero marks a free slot
+            uint32_t key = ((uint32_t)prefix << 8 | pixel) + 1;
+            uint32_t slot = (key * 2654435761u) >> (32 - LZW_HASH_BITS);
+            while (self->lzw_keys[slot] && self->lzw_keys[slot] != key) {
+                slot = (slot + 1) & mask;
+            }
+            if (self->lzw_keys[slot] == key) {
+                prefix = self->lzw_codes[slot];
+                continue;
+            }
+
+            gif_put_code(&out, prefix, size);
+            self->lzw_keys[slot] = key;
+            self->lzw_codes[slot] = ++last;
+            if (last >= (1 << size) && size < LZW_MAX_BITS) {
+                size++;
+            }
+            if (last == LZW_LAST_CODE) {
+                gif_put_code(&out, LZW_CLEAR, size);
+                memset(self->lzw_keys, 0, sizeof(uint32_t) << LZW_HASH_BITS);
+                size = LZW_MIN_BITS + 1;
+                last = LZW_END;
+            }
+            prefix = pixel;
+        }
+    }
+
+    gif_put_code(&out, prefix, size);
+    // The decoder takes a code for that one, which may grow the size
+    if (last + 1 >= (1 << size) && size < LZW_MAX_BITS) {
+        size++;
+    }
+    gif_put_code(&out, LZW_END, size);
+    gif_end_bits(&out);
+}
+
+bool gif_write_frame(GifWriter *self, const YCCPicture *picture) {
+    if (picture->width != self->width || picture->height != self->height) {
+        u_error("[gif_write_frame] Frame is %dx%d, not %dx%d.",
+            picture->width, picture->height, self->width, self->height);
+        return false;
+    }
+
+    int rows = cpu_l2_size() / 2 / (self->width * 4);
+    GifJob job = { self, picture, true, true, self->written == 0,
+        rows < 2 ? 2 : rows };
+    int strips = (self->height + job.strip_rows - 1) / job.strip_rows;
+
+    // The palette is made once, out of the first frame
+    if (!self->quant) {
+        job.map = false;
+        tpool_for(strips, gif_frame_strip, &job);
+
+        self->quant = quant_new(self->rgb, (size_t)self->width * self->height,
+            GIF_COLORS);
+        if (!self->quant) {
+            return false;
+        }
+        gif_header(self);
+
+        job.convert = false;
+        job.map = true;
+    }
+    tpool_for(strips, gif_frame_strip, &job);
+
+    GifBox box = gif_find_box(self);
+    uint8_t gce[8] = { 0x21, 0xF9, 4 };
+    uint8_t descriptor[10] = { 0x2C };
+
+    gce[3] = GIF_DISPOSE_NONE << 2 | (job.whole ? 0 : 1);
+    u_put_le16(gce + 4, (100 + self->fps / 2) / self->fps);
+    gce[6] = GIF_TRANSPARENT;
+    fwrite(gce, 1, sizeof(gce), self->file);
+
+    uint8_t *p = u_put_le16(descriptor + 1, box.x);
+    p = u_put_le16(p, box.y);
+    p = u_put_le16(p, box.width);
+    u_put_le16(p, box.height);
+    fwrite(descriptor, 1, sizeof(descriptor), self->file);
+
+    gif_encode(self, &box, job.whole);
+
+    // What's been mapped now is what the next frame is compared to
+    uint8_t *t = self->previous;
+    self->previous = self->current;
+    self->current = t;
+    self->written++;
+
+    return !ferror(self->file);
+}
+
+bool gif_writer_close(GifWriter **selfp) {
+    GifWriter *self = *selfp;
+    bool rc = true;
+
+    if (self->file) {
+        fputc(0x3B, self->file);
+        rc = !ferror(self->file);
+        rc = fclose(self->file) == 0 && rc;
+    }
+
+    if (self->quant) {
+        quant_delete(&self->quant);
+    }
+    free(self->rgb);
+    free(self->previous);
+    free(self->current);
+    free(self->extents);
+    free(self->lzw_keys);
+    free(self->lzw_codes);
+    free(self);
+    *selfp = NULL;
+
+    return rc;
+}
+
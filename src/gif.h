@@ -0,0 +1,40 @@
+#ifndef __GIF_H_
+#define __GIF_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "picture.h"
+#include "quant.h"
+
+#define GIF_COLORS  255 // and one more index for transparency
+
+/*
+ * An animated GIF with one global palette, made from the first frame.
+ * Every later frame is only the box around the pixels whose palette
+ * index differs from the frame before it, with the unchanged ones in
+ * the box left transparent.
+ */
+typedef struct {
+    FILE        *file;
+    int         width;
+    int         height;
+    int         fps;
+    int         written;
+    Quantizer   *quant;
+    uint8_t     *rgb; // of the frame being written
+    uint8_t     *previous; // palette indices of the last frame written
+    uint8_t     *current; // palette indices of the frame being written
+    int         *extents; // first and last changed pixel of each row
+    uint32_t    *lzw_keys; // string table of the LZW encoder
+    uint16_t    *lzw_codes;
+} GifWriter;
+
+GifWriter *gif_writer_new(const char *path, int width, int height, int fps);
+bool gif_write_frame(GifWriter *self, const YCCPicture *picture);
+
+// Ends and closes the file.
+bool gif_writer_close(GifWriter **selfp);
+
+#endif
+
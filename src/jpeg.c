@@ -0,0 +1,566 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+// The stb_image and stb_image_write implementations live here rather than
+// in picture.c because the codecs below are built from their internals.
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include "jpeg.h"
+#include "convert.h"
+#include "util.h"
+
+#define OUTPUT_BUFFER_SIZE  65536
+
+typedef struct {
+    JpegWriteFunc func;
+    void *context;
+    int length;
+    uint8_t data[OUTPUT_BUFFER_SIZE];
+} JpegOutput;
+
+// Standard tables from ITU T.81 Annex K, in the layout stb uses
+static const unsigned char std_dc_luminance_nrcodes[] = {0,0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0};
+static const unsigned char std_dc_luminance_values[] = {0,1,2,3,4,5,6,7,8,9,10,11};
+static const unsigned char std_ac_luminance_nrcodes[] = {0,0,2,1,3,3,2,4,3,5,5,4,4,0,0,1,0x7d};
+static const unsigned char std_ac_luminance_values[] = {
+    0x01,0x02,0x03,0x00,0x04,0x11,0x05,0x12,0x21,0x31,0x41,0x06,0x13,0x51,0x61,0x07,0x22,0x71,0x14,0x32,0x81,0x91,0xa1,0x08,
+    0x23,0x42,0xb1,0xc1,0x15,0x52,0xd1,0xf0,0x24,0x33,0x62,0x72,0x82,0x09,0x0a,0x16,0x17,0x18,0x19,0x1a,0x25,0x26,0x27,0x28,
+    0x29,0x2a,0x34,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0x4a,0x53,0x54,0x55,0x56,0x57,0x58,0x59,
+    0x5a,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x83,0x84,0x85,0x86,0x87,0x88,0x89,
+    0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,0xa6,0xa7,0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,0xb5,0xb6,
+    0xb7,0xb8,0xb9,0xba,0xc2,0xc3,0xc4,0xc5,0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,0xe1,0xe2,
+    0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf1,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa
+};
+static const unsigned char std_dc_chrominance_nrcodes[] = {0,0,3,1,1,1,1,1,1,1,1,1,0,0,0,0,0};
+static const unsigned char std_dc_chrominance_values[] = {0,1,2,3,4,5,6,7,8,9,10,11};
+static const unsigned char std_ac_chrominance_nrcodes[] = {0,0,2,1,2,4,4,3,4,7,5,4,4,0,1,2,0x77};
+static const unsigned char std_ac_chrominance_values[] = {
+    0x00,0x01,0x02,0x03,0x11,0x04,0x05,0x21,0x31,0x06,0x12,0x41,0x51,0x07,0x61,0x71,0x13,0x22,0x32,0x81,0x08,0x14,0x42,0x91,
+    0xa1,0xb1,0xc1,0x09,0x23,0x33,0x52,0xf0,0x15,0x62,0x72,0xd1,0x0a,0x16,0x24,0x34,0xe1,0x25,0xf1,0x17,0x18,0x19,0x1a,0x26,
+    0x27,0x28,0x29,0x2a,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0x4a,0x53,0x54,0x55,0x56,0x57,0x58,
+    0x59,0x5a,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x82,0x83,0x84,0x85,0x86,0x87,
+    0x88,0x89,0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,0xa6,0xa7,0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,
+    0xb5,0xb6,0xb7,0xb8,0xb9,0xba,0xc2,0xc3,0xc4,0xc5,0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,
+    0xe2,0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa
+};
+static const int YQT[] = {16,11,10,16,24,40,51,61,12,12,14,19,26,58,60,55,14,13,16,24,40,57,69,56,14,17,22,29,51,87,80,62,18,22,
+                          37,56,68,109,103,77,24,35,55,64,81,104,113,92,49,64,78,87,103,121,120,101,72,92,95,98,112,100,103,99};
+static const int UVQT[] = {17,18,24,47,99,99,99,99,18,21,26,66,99,99,99,99,24,26,56,99,99,99,99,99,47,66,99,99,99,99,99,99,
+                           99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99};
+static const float aasf[] = { 1.0f * 2.828427125f, 1.387039845f * 2.828427125f, 1.306562965f * 2.828427125f, 1.175875602f * 2.828427125f,
+                              1.0f * 2.828427125f, 0.785694958f * 2.828427125f, 0.541196100f * 2.828427125f, 0.275899379f * 2.828427125f };
+
+static unsigned short YDC_HT[256][2];
+static unsigned short UVDC_HT[256][2];
+static unsigned short YAC_HT[256][2];
+static unsigned short UVAC_HT[256][2];
+
+// Studio swing samples as JFIF (full swing) DCT input, level shifted
+static float luma_du[256];
+static float chroma_du[256];
+
+// JFIF samples as studio swing
+static uint8_t luma_in[256];
+static uint8_t chroma_in[256];
+
+// Reduced IDCT bases: idct_basis[n][x][u] for an n-point output, n = 1..4
+static float idct_basis[5][4][4];
+
+static pthread_once_t tables_ready = PTHREAD_ONCE_INIT;
+
+// Component planes of the JPEG being decoded at 1 / scaled_by on this thread
+static _Thread_local stbi__jpeg *scaled_jpeg;
+static _Thread_local int scaled_by;
+
+static void build_huffman(const unsigned char *nrcodes,
+    const unsigned char *values, unsigned short table[256][2]) {
+    int code = 0;
+    int k = 0;
+
+    for (int length = 1; length <= 16; length++) {
+        for (int i = 0; i < nrcodes[length]; i++, k++) {
+            table[values[k]][0] = code++;
+            table[values[k]][1] = length;
+        }
+        code <<= 1;
+    }
+}
+
+static float full_swing(double v) {
+    return (float)(v < 0 ? 0 : (v > 255 ? 255 : v)) - 128.0f;
+}
+
+static void build_tables(void) {
+    build_huffman(std_dc_luminance_nrcodes, std_dc_luminance_values, YDC_HT);
+    build_huffman(std_ac_luminance_nrcodes, std_ac_luminance_values, YAC_HT);
+    build_huffman(std_dc_chrominance_nrcodes, std_dc_chrominance_values,
+        UVDC_HT);
+    build_huffman(std_ac_chrominance_nrcodes, std_ac_chrominance_values,
+        UVAC_HT);
+
+    for (int v = 0; v < 256; v++) {
+        luma_du[v] = full_swing((v - 16) * 255.0 / 219.0);
+        chroma_du[v] = full_swing(128.0 + (v - 128) * 255.0 / 224.0);
+        luma_in[v] = 16 + (v * 219 + 127) / 255;
+        chroma_in[v] = 128 + ((v - 128) * 224 + (v < 128 ? -127 : 127)) / 255;
+    }
+
+    // The lowest n x n coefficients sampled at the centres of n points
+    // which span the block, so a DC-only block still averages to DC / 8
+    for (int n = 1; n <= 4; n++) {
+        for (int x = 0; x < n; x++) {
+            for (int u = 0; u < n; u++) {
+                idct_basis[n][x][u] = (u == 0 ? (float)M_SQRT1_2 : 1.0f) / 2.0f
+                    * (float)cos((2 * x + 1) * u * M_PI / (2 * n));
+            }
+        }
+    }
+}
+
+static void jpeg_flush(JpegOutput *out) {
+    if (out->length > 0) {
+        out->func(out->context, out->data, out->length);
+        out->length = 0;
+    }
+}
+
+static void jpeg_buffered_write(void *context, void *data, int size) {
+    JpegOutput *out = context;
+
+    if (out->length + size > OUTPUT_BUFFER_SIZE) {
+        jpeg_flush(out);
+    }
+    if (size >= OUTPUT_BUFFER_SIZE) {
+        out->func(out->context, data, size);
+        return;
+    }
+
+    memcpy(out->data + out->length, data, size);
+    out->length += size;
+}
+
+// Fetches an 8x8 block, repeating the last row and column past the edges.
+static void jpeg_load_block(float *du, const uint8_t *plane, int width,
+    int height, int x0, int y0, const float *lut) {
+    for (int row = 0; row < 8; row++) {
+        int y = y0 + row < height ? y0 + row : height - 1;
+        const uint8_t *line = plane + y * width;
+
+        for (int col = 0; col < 8; col++) {
+            int x = x0 + col < width ? x0 + col : width - 1;
+            du[row * 8 + col] = lut[line[x]];
+        }
+    }
+}
+
+// Upsamples the chroma of pixel rows y0 to y0 + 7 into `rows`.
+static void jpeg_upsample_rows(uint8_t *rows, const uint8_t *plane,
+    int width, int height, int y0) {
+    int chroma_width = width / 4;
+
+    for (int row = 0; row < 8; row++) {
+        int y = y0 + row < height ? y0 + row : height - 1;
+        // Odd rows lie halfway between two chroma rows, except the last one
+        const uint8_t *top = plane + (y / 2) * chroma_width;
+        const uint8_t *bottom = (y % 2 == 1 && y < height - 1)
+            ? top + chroma_width
+            : top;
+
+        conv_upsample_chroma_row(top, bottom, rows + row * width, width);
+    }
+}
+
+void jpeg_buffers_free(JpegBuffers *self) {
+    free(self->decoder);
+    free(self->output);
+    free(self->chroma_rows);
+    *self = (JpegBuffers){ 0 };
+}
+
+// Makes sure the encoder's buffers are there for a picture `width` wide.
+static bool jpeg_output_buffers(JpegBuffers *self, int width) {
+    if (!self->output) {
+        self->output = malloc(sizeof(JpegOutput));
+    }
+    if (self->chroma_width < width) {
+        free(self->chroma_rows);
+        self->chroma_rows = malloc(sizeof(uint8_t) * 2 * 8 * width);
+        self->chroma_width = self->chroma_rows ? width : 0;
+    }
+
+    return self->output && self->chroma_rows;
+}
+
+bool jpeg_write(const YCCPicture *picture, JpegWriteFunc func, void *context,
+    int quality, JpegBuffers *buffers) {
+    int width = picture->width;
+    int height = picture->height;
+
+    float fdtbl_Y[64], fdtbl_UV[64];
+    unsigned char YTable[64], UVTable[64];
+
+    if (width <= 0 || height <= 0 || width > 0xFFFF || height > 0xFFFF) {
+        u_error("[jpeg_write] Picture of %dx%d can't be stored as JPEG.",
+            width, height);
+        return false;
+    }
+
+    JpegBuffers own = { 0 };
+    if (!buffers) {
+        buffers = &own;
+    }
+    if (!jpeg_output_buffers(buffers, width)) {
+        u_error("[jpeg_write] Failed to allocate output buffers!");
+        jpeg_buffers_free(&own);
+        return false;
+    }
+
+    JpegOutput *out = buffers->output;
+    uint8_t *cb_rows = buffers->chroma_rows;
+    uint8_t *cr_rows = cb_rows + 8 * width;
+    out->func = func;
+    out->context = context;
+    out->length = 0;
+
+    stbi__write_context s;
+    stbi__start_write_callbacks(&s, jpeg_buffered_write, out);
+
+    pthread_once(&tables_ready, build_tables);
+
+    quality = quality ? quality : 90;
+    quality = quality < 1 ? 1 : quality > 100 ? 100 : quality;
+    quality = quality < 50 ? 5000 / quality : 200 - quality * 2;
+
+    for (int i = 0; i < 64; ++i) {
+        int yti = (YQT[i] * quality + 50) / 100;
+        int uvti = (UVQT[i] * quality + 50) / 100;
+        YTable[stbiw__jpg_ZigZag[i]] = yti < 1 ? 1 : yti > 255 ? 255 : yti;
+        UVTable[stbiw__jpg_ZigZag[i]] = uvti < 1 ? 1 : uvti > 255 ? 255 : uvti;
+    }
+
+    for (int row = 0, k = 0; row < 8; ++row) {
+        for (int col = 0; col < 8; ++col, ++k) {
+            fdtbl_Y[k] = 1 / (YTable[stbiw__jpg_ZigZag[k]]
+                * aasf[row] * aasf[col]);
+            fdtbl_UV[k] = 1 / (UVTable[stbiw__jpg_ZigZag[k]]
+                * aasf[row] * aasf[col]);
+        }
+    }
+
+    {
+        static const unsigned char head0[] = { 0xFF,0xD8,0xFF,0xE0,0,0x10,'J','F','I','F',0,1,1,0,0,1,0,1,0,0,0xFF,0xDB,0,0x84,0 };
+        static const unsigned char head2[] = { 0xFF,0xDA,0,0xC,3,1,0,2,0x11,3,0x11,0,0x3F,0 };
+        const unsigned char head1[] = { 0xFF,0xC0,0,0x11,8,(unsigned char)(height>>8),STBIW_UCHAR(height),(unsigned char)(width>>8),STBIW_UCHAR(width),
+                                        3,1,0x11,0,2,0x11,1,3,0x11,1,0xFF,0xC4,0x01,0xA2,0 };
+        s.func(s.context, (void *)head0, sizeof(head0));
+        s.func(s.context, (void *)YTable, sizeof(YTable));
+        stbiw__putc(&s, 1);
+        s.func(s.context, UVTable, sizeof(UVTable));
+        s.func(s.context, (void *)head1, sizeof(head1));
+        s.func(s.context, (void *)(std_dc_luminance_nrcodes + 1), sizeof(std_dc_luminance_nrcodes) - 1);
+        s.func(s.context, (void *)std_dc_luminance_values, sizeof(std_dc_luminance_values));
+        stbiw__putc(&s, 0x10); // HTYACinfo
+        s.func(s.context, (void *)(std_ac_luminance_nrcodes + 1), sizeof(std_ac_luminance_nrcodes) - 1);
+        s.func(s.context, (void *)std_ac_luminance_values, sizeof(std_ac_luminance_values));
+        stbiw__putc(&s, 1); // HTUDCinfo
+        s.func(s.context, (void *)(std_dc_chrominance_nrcodes + 1), sizeof(std_dc_chrominance_nrcodes) - 1);
+        s.func(s.context, (void *)std_dc_chrominance_values, sizeof(std_dc_chrominance_values));
+        stbiw__putc(&s, 0x11); // HTUACinfo
+        s.func(s.context, (void *)(std_ac_chrominance_nrcodes + 1), sizeof(std_ac_chrominance_nrcodes) - 1);
+        s.func(s.context, (void *)std_ac_chrominance_values, sizeof(std_ac_chrominance_values));
+        s.func(s.context, (void *)head2, sizeof(head2));
+    }
+
+    // Encode 8x8 macroblocks, upsampling chroma a block row at a time
+    {
+        static const unsigned short fillBits[] = {0x7F, 7};
+        int DCY = 0, DCU = 0, DCV = 0;
+        int bitBuf = 0, bitCnt = 0;
+        float du[64];
+
+        for (int y = 0; y < height; y += 8) {
+            jpeg_upsample_rows(cb_rows, picture->cb, width, height, y);
+            jpeg_upsample_rows(cr_rows, picture->cr, width, height, y);
+
+            for (int x = 0; x < width; x += 8) {
+                jpeg_load_block(du, picture->luma, width, height, x, y,
+                    luma_du);
+                DCY = stbiw__jpg_processDU(&s, &bitBuf, &bitCnt, du,
+                    fdtbl_Y, DCY, YDC_HT, YAC_HT);
+
+                jpeg_load_block(du, cb_rows, width, 8, x, 0, chroma_du);
+                DCU = stbiw__jpg_processDU(&s, &bitBuf, &bitCnt, du,
+                    fdtbl_UV, DCU, UVDC_HT, UVAC_HT);
+
+                jpeg_load_block(du, cr_rows, width, 8, x, 0, chroma_du);
+                DCV = stbiw__jpg_processDU(&s, &bitBuf, &bitCnt, du,
+                    fdtbl_UV, DCV, UVDC_HT, UVAC_HT);
+            }
+        }
+
+        // Do the bit alignment of the EOI marker
+        stbiw__jpg_writeBits(&s, &bitBuf, &bitCnt, fillBits);
+    }
+
+    stbiw__putc(&s, 0xFF);
+    stbiw__putc(&s, 0xD9);
+
+    jpeg_flush(out);
+    jpeg_buffers_free(&own);
+
+    return true;
+}
+
+// Rescales the samples of a picture from full swing to studio swing.
+static void jpeg_to_studio_swing(YCCPicture *self) {
+    size_t luma_size = (size_t)self->width * self->height;
+    size_t chroma_size = luma_size / 8;
+
+    for (size_t i = 0; i < luma_size; i++) {
+        self->luma[i] = luma_in[self->luma[i]];
+    }
+    for (size_t i = 0; i < chroma_size; i++) {
+        self->cb[i] = chroma_in[self->cb[i]];
+        self->cr[i] = chroma_in[self->cr[i]];
+    }
+}
+
+// Stands in for stb_image's IDCT when decoding at 1 / scaled_by: turns
+// the block into (8 / scaled_by)^2 samples, packed at the start of its
+// component's buffer with a row stride of w2 / scaled_by.
+static void jpeg_scaled_idct(stbi_uc *out, int out_stride, short data[64]) {
+    stbi__jpeg *j = scaled_jpeg;
+    int n = 8 / scaled_by;
+    int k = 0;
+
+    while (k < j->s->img_n - 1 && (out < j->img_comp[k].data
+        || out >= j->img_comp[k].data + (size_t)out_stride * j->img_comp[k].h2)) {
+        k++;
+    }
+
+    size_t offset = out - j->img_comp[k].data;
+    int x0 = (int)(offset % out_stride) / scaled_by;
+    int y0 = (int)(offset / out_stride) / scaled_by;
+    int stride = out_stride / scaled_by;
+    stbi_uc *dst = j->img_comp[k].data + (size_t)y0 * stride + x0;
+
+    // Columns first, over the n x n coefficients in use
+    float tmp[4][4];
+    for (int u = 0; u < n; u++) {
+        for (int y = 0; y < n; y++) {
+            float sum = 0.0f;
+            for (int v = 0; v < n; v++) {
+                sum += idct_basis[n][y][v] * data[v * 8 + u];
+            }
+            tmp[y][u] = sum;
+        }
+    }
+
+    for (int y = 0; y < n; y++) {
+        for (int x = 0; x < n; x++) {
+            float sum = 128.5f;
+            for (int u = 0; u < n; u++) {
+                sum += idct_basis[n][x][u] * tmp[y][u];
+            }
+            dst[y * stride + x] = sum < 0.0f ? 0 : (sum > 255.0f ? 255 : (int)sum);
+        }
+    }
+}
+
+// Picks the smallest IDCT scale, 1/8 at most, which still leaves more
+// than `height` rows of a picture `image_height` rows tall.
+static int jpeg_scale_for(int image_height, int height) {
+    int scale = 1;
+
+    while (scale < 8 && image_height / (scale * 2) > height) {
+        scale *= 2;
+    }
+
+    return scale;
+}
+
+// Resizes the decoded component planes to a picture `height` rows tall.
+static YCCPicture *jpeg_resize_components(stbi__jpeg *j, int height,
+    int scale) {
+    YCCPlane planes[3];
+
+    for (int k = 0; k < j->s->img_n; k++) {
+        int h = j->img_comp[k].h;
+        int v = j->img_comp[k].v;
+        int width = (j->s->img_x * h + j->img_h_max - 1) / j->img_h_max;
+        int rows = (j->s->img_y * v + j->img_v_max - 1) / j->img_v_max;
+
+        planes[k].data = j->img_comp[k].data;
+        // A partial sample at the edges would stretch the picture
+        planes[k].width = scale > 1 && width >= scale ? width / scale : width;
+        planes[k].height = scale > 1 && rows >= scale ? rows / scale : rows;
+        planes[k].stride = j->img_comp[k].w2 / scale;
+    }
+
+    bool grey = j->s->img_n == 1;
+    YCCPicture *self = ycc_from_planes(&planes[0],
+        grey ? NULL : &planes[1], grey ? NULL : &planes[2], height);
+    if (!self) {
+        return NULL;
+    }
+
+    // Grey chroma is 128 either way
+    pthread_once(&tables_ready, build_tables);
+    jpeg_to_studio_swing(self);
+
+    return self;
+}
+
+// Tells from the frame header alone whether the component planes will
+// have a layout we can use as is.
+static bool jpeg_layout_usable(const stbi__jpeg *j, bool resizing) {
+    int n = j->s->img_n;
+    bool is_rgb = n == 3
+        && (j->rgb == 3 || (j->app14_color_transform == 0 && !j->jfif));
+
+    if ((n != 1 && n != 3) || is_rgb) {
+        return false;
+    }
+    if (resizing) {
+        return true;
+    }
+
+    // Luma has to come at full resolution, chroma at an integral fraction
+    int h_max = 1;
+    int v_max = 1;
+    for (int k = 0; k < n; k++) {
+        if (j->img_comp[k].h > h_max) {
+            h_max = j->img_comp[k].h;
+        }
+        if (j->img_comp[k].v > v_max) {
+            v_max = j->img_comp[k].v;
+        }
+    }
+    for (int k = 0; k < n; k++) {
+        if (h_max % j->img_comp[k].h != 0 || v_max % j->img_comp[k].v != 0) {
+            return false;
+        }
+    }
+
+    return j->img_comp[0].h == h_max && j->img_comp[0].v == v_max;
+}
+
+// Takes the decoded component planes over.
+static YCCPicture *jpeg_components_to_ycc(stbi__jpeg *j, int desired_height,
+    int scale) {
+    int n = j->s->img_n;
+
+    if (desired_height > 0) {
+        return jpeg_resize_components(j, desired_height, scale);
+    }
+
+    int width = j->s->img_x - (j->s->img_x % 4);
+    int height = j->s->img_y - (j->s->img_y % 2);
+
+    YCCPicture *self = ycc_new(width, height);
+    if (!self) {
+        return NULL;
+    }
+
+    pthread_once(&tables_ready, build_tables);
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t *src = j->img_comp[0].data + y * j->img_comp[0].w2;
+        uint8_t *dst = self->luma + y * width;
+
+        for (int x = 0; x < width; x++) {
+            dst[x] = luma_in[src[x]];
+        }
+    }
+
+    int chroma_width = width / 4;
+    int chroma_height = height / 2;
+
+    if (n == 1) {
+        memset(self->cb, 128, chroma_width * chroma_height);
+        memset(self->cr, 128, chroma_width * chroma_height);
+        return self;
+    }
+
+    // Chroma of pixel (4 cx, 2 cy), wherever the JPEG keeps it
+    for (int k = 1; k <= 2; k++) {
+        int hs = j->img_h_max / j->img_comp[k].h;
+        int vs = j->img_v_max / j->img_comp[k].v;
+        uint8_t *plane = k == 1 ? self->cb : self->cr;
+
+        for (int cy = 0; cy < chroma_height; cy++) {
+            const uint8_t *src = j->img_comp[k].data
+                + (cy * 2 / vs) * j->img_comp[k].w2;
+            uint8_t *dst = plane + cy * chroma_width;
+
+            for (int cx = 0; cx < chroma_width; cx++) {
+                dst[cx] = chroma_in[src[cx * 4 / hs]];
+            }
+        }
+    }
+
+    return self;
+}
+
+YCCPicture *jpeg_read(const uint8_t *data, int length, int height,
+    bool *failed, JpegBuffers *buffers) {
+    *failed = false;
+    if (length < 2 || data[0] != 0xFF || data[1] != 0xD8) {
+        return NULL;
+    }
+
+    JpegBuffers own = { 0 };
+    if (!buffers) {
+        buffers = &own;
+    }
+    if (!buffers->decoder) {
+        buffers->decoder = malloc(sizeof(stbi__jpeg));
+    }
+    if (!buffers->decoder) {
+        u_error("[jpeg_read] Failed to allocate decoder!");
+        *failed = true;
+        return NULL;
+    }
+
+    stbi__context s;
+    stbi__start_mem(&s, data, length);
+
+    stbi__jpeg *j = buffers->decoder;
+    j->s = &s;
+    stbi__setup_jpeg(j);
+    s.img_n = 0; // make stbi__cleanup_jpeg safe
+
+    // Headers first, so that no scan is decoded for a layout we can't
+    // use, and to know how far the IDCT may scale down
+    YCCPicture *self = NULL;
+    if (!stbi__decode_jpeg_header(j, STBI__SCAN_header)) {
+        u_error("[jpeg_read] Bad JPEG: %s", stbi_failure_reason());
+        *failed = true;
+    } else if (jpeg_layout_usable(j, height > 0)) {
+        int scale = height > 0 ? jpeg_scale_for(s.img_y, height) : 1;
+        if (scale > 1) {
+            pthread_once(&tables_ready, build_tables);
+            j->idct_block_kernel = jpeg_scaled_idct;
+            scaled_jpeg = j;
+            scaled_by = scale;
+        }
+
+        stbi__rewind(&s);
+        if (stbi__decode_jpeg_image(j)) {
+            self = jpeg_components_to_ycc(j, height, scale);
+        } else {
+            u_error("[jpeg_read] Bad JPEG: %s", stbi_failure_reason());
+        }
+        *failed = !self;
+
+        stbi__cleanup_jpeg(j);
+    }
+
+    jpeg_buffers_free(&own);
+    return self;
+}
@@ -0,0 +1,44 @@
+#ifndef __JPEG_H_
+#define __JPEG_H_
+
+#include <stdbool.h>
+#include "picture.h"
+
+typedef void (*JpegWriteFunc)(void *context, void *data, int size);
+
+/*
+ * What jpeg_read and jpeg_write allocate, kept from one frame of a
+ * stream to the next by whoever owns it. Starts zeroed. Either call
+ * takes NULL instead, to allocate and free it all on the spot.
+ */
+typedef struct {
+    void        *decoder; // stb_image's, kept private to jpeg.c
+    void        *output; // writes buffered on their way to the callback
+    uint8_t     *chroma_rows; // one block row of upsampled Cb, then Cr
+    int         chroma_width; // of the pictures `chroma_rows` fits
+} JpegBuffers;
+
+/*
+ * Decodes a YCbCr or greyscale JPEG into a new picture, point-sampling
+ * the decoder's own component planes, or resizing them if `height` is
+ * positive. Returns NULL for anything else, including RGB and CMYK
+ * JPEGs, so that the caller can fall back to a decode through RGB. A
+ * JPEG that is broken rather than unsupported sets `failed` too, as
+ * there is no point in decoding it again.
+ */
+YCCPicture *jpeg_read(const uint8_t *data, int length, int height,
+    bool *failed, JpegBuffers *buffers);
+
+/*
+ * Encodes the planes of a picture as a baseline JFIF with the same
+ * layout stb_image_write uses. There is no trip through RGB: samples
+ * are only rescaled to full swing, and chroma is interpolated to full
+ * resolution as ycc_save_picture does for RGB formats.
+ */
+bool jpeg_write(const YCCPicture *picture, JpegWriteFunc func, void *context,
+    int quality, JpegBuffers *buffers);
+
+void jpeg_buffers_free(JpegBuffers *self);
+
+#endif
+
@@ -8,9 +8,9 @@ int main(int argc, char **argv) {
         return EXIT_FAILURE;
     }
     
-    secamizer_run(secamizer);
+    bool ok = secamizer_run(secamizer);
     secamizer_destroy(&secamizer);
 
-    return EXIT_SUCCESS;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
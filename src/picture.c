@@ -2,21 +2,94 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
-#define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
+
+#include "bufpool.h"
+
+// Work memory of resizes is recycled too, strips ask for the same size
+static BufPool resize_pool = BUFPOOL_INITIALIZER;
+
+#define STBIR_MALLOC(size, context) ((void)(context), bufpool_get(&resize_pool, size))
+#define STBIR_FREE(ptr, context) ((void)(context), bufpool_put(&resize_pool, ptr))
 #define STB_IMAGE_RESIZE_IMPLEMENTATION
 #include "stb_image_resize.h"
 
 #include "picture.h"
+#include "convert.h"
+#include "jpeg.h"
+#include "bitmap.h"
+#include "raw.h"
+#include "tpool.h"
+#include "cpu.h"
 #include "util.h"
 
 #define JPEG_QUALITY    0
 #define PNG_STRIDE      0
 
+// Planes and RGB scratch buffers are recycled between pictures
+static BufPool luma_pool = BUFPOOL_INITIALIZER;
+static BufPool chroma_pool = BUFPOOL_INITIALIZER;
+static BufPool rgb_pool = BUFPOOL_INITIALIZER;
+
+// Conversion loops run on the pool in strips of rows, one strip per task
+typedef struct {
+    uint8_t         *rgb;
+    int             rgb_width; // pixels per RGB row
+    YCCPicture      *picture;
+    int             strip_rows;
+} ConvertJob;
+
+// Rows per strip, even, so that a strip's source and destination take
+// no more than half of L2.
+static int strip_rows(size_t row_bytes) {
+    int rows = cpu_l2_size() / 2 / row_bytes;
+    rows -= rows % 2;
+    return rows < 2 ? 2 : rows;
+}
+
+#define RESIZE_STRIPS       2  /* strips per thread */
+#define RESIZE_MIN_ROWS     16 /* output rows per strip at least */
+
+typedef struct {
+    const YCCPlane  *input;
+    uint8_t         *output;
+    int             output_width;
+    int             output_height;
+    float           x_scale; // output samples per input sample
+    float           y_scale;
+    float           x_offset; // in output samples
+    float           y_offset;
+    int             strip_rows;
+    atomic_bool     failed;
+} ResizeJob;
+
+// Conversion of RGB to planes before resizing, also in strips. Chroma
+// is box filtered down by `box_x` x `box_y` while it is at it.
+typedef struct {
+    const uint8_t   *rgb;
+    int             width;
+    int             height;
+    uint8_t         *luma;
+    uint8_t         *cb;
+    uint8_t         *cr;
+    int             chroma_width;
+    int             box_x;
+    int             box_y;
+    int             strip_rows;
+} PlanesJob;
+
+// Box filtering of a plane by whole samples, one output row per task
+typedef struct {
+    const YCCPlane  *input;
+    uint8_t         *output;
+    int             width;
+    int             box_x;
+    int             box_y;
+} BoxJob;
+
 YCCPicture *ycc_new(int width, int height) {
-    if (width % 4 != 0 || height % 2 != 0) {
+    if (width <= 0 || height <= 0 || width % 4 != 0 || height % 2 != 0) {
         u_error("[ycbcr_new] Width must be divisible by 4 and height by 2");
         return NULL;
     }
@@ -30,165 +103,486 @@ YCCPicture *ycc_new(int width, int height) {
     self->width = width;
     self->height = height;
 
-    size_t luma_size = self->width * self->height;
-    size_t chroma_size = (self->width / 4) * (self->height / 2);
+    size_t luma_size = (size_t)self->width * self->height;
+    size_t chroma_size = (size_t)(self->width / 4) * (self->height / 2);
 
-    self->luma = malloc(sizeof(uint8_t) * luma_size);
-    self->cb = malloc(sizeof(uint8_t) * chroma_size);
-    self->cr = malloc(sizeof(uint8_t) * chroma_size);
+    self->luma = bufpool_get(&luma_pool, luma_size);
+    self->luma_refs = malloc(sizeof(atomic_int));
+    self->cb = bufpool_get(&chroma_pool, chroma_size);
+    self->cr = bufpool_get(&chroma_pool, chroma_size);
 
-    if (!self->luma || !self->cb || !self->cr) {
+    if (!self->luma || !self->luma_refs || !self->cb || !self->cr) {
+        bufpool_put(&luma_pool, self->luma);
+        free(self->luma_refs);
+        bufpool_put(&chroma_pool, self->cb);
+        bufpool_put(&chroma_pool, self->cr);
         free(self);
         return NULL;
     }
 
+    atomic_init(self->luma_refs, 1);
+
     return self;
 }
 
+// Drops this picture's reference to the luma plane.
+static void ycc_release_luma(YCCPicture *self) {
+    if (atomic_fetch_sub(self->luma_refs, 1) == 1) {
+        bufpool_put(&luma_pool, self->luma);
+        free(self->luma_refs);
+    }
+    self->luma = NULL;
+    self->luma_refs = NULL;
+}
+
+// Gives the picture a luma plane of its own, copying the shared one
+// only if `keep` is set.
+static bool ycc_detach_luma(YCCPicture *self, size_t luma_size, bool keep) {
+    uint8_t *luma = bufpool_get(&luma_pool, luma_size);
+    atomic_int *refs = malloc(sizeof(atomic_int));
+    if (!luma || !refs) {
+        u_error("[ycc_detach_luma] Failed to allocate luma plane!");
+        bufpool_put(&luma_pool, luma);
+        free(refs);
+        return false;
+    }
+
+    if (keep) {
+        memcpy(luma, self->luma, luma_size);
+    }
+
+    ycc_release_luma(self);
+    self->luma = luma;
+    self->luma_refs = refs;
+    atomic_init(self->luma_refs, 1);
+
+    return true;
+}
+
+bool ycc_own_luma(YCCPicture *self) {
+    if (atomic_load(self->luma_refs) == 1) {
+        return true;
+    }
+
+    return ycc_detach_luma(self, (size_t)self->width * self->height, true);
+}
+
 void ycc_reset(YCCPicture *self) {
-    size_t luma_size = self->width * self->height;
-    size_t chroma_size = (self->width / 4) * (self->height / 2);
+    size_t luma_size = (size_t)self->width * self->height;
+    size_t chroma_size = (size_t)(self->width / 4) * (self->height / 2);
+    if (atomic_load(self->luma_refs) > 1
+        && !ycc_detach_luma(self, luma_size, false)) {
+        return;
+    }
     memset(self->luma, 128, luma_size);
     memset(self->cb, 128, chroma_size);
     memset(self->cr, 128, chroma_size);
 }
 
 YCCPicture *ycc_load_picture(const char *path, int desired_height) {
-    FILE *file;
-    file = (path == (const char *)0x57D) ? stdin : fopen(path, "rb");
-    if (!file) {
-        u_error("File \"%s\" doesn't exist.", path);
+    UFileData file;
+    if (!u_load_file(&file, path == (const char *)0x57D ? NULL : path)) {
         return NULL;
     }
 
-    int original_width;
-    int original_height;
-    uint8_t *rgb = stbi_load_from_file(file, &original_width, &original_height, NULL, 3);
-    if (!rgb) {
-        u_error("[ycbcr_load_picture] Failed to load picture with STBI: %s", path);
-        return NULL;
+    YCCPicture *self = ycc_decode_picture(file.data, file.length,
+        desired_height);
+    if (!self) {
+        u_error("[ycbcr_load_picture] Failed to load picture: %s", path);
     }
 
-    fclose(file);
+    u_unload_file(&file);
+    return self;
+}
 
-    if (desired_height > 0) {
-        double aspect_ratio = (double)original_width / (double)original_height;
-        int desired_width = desired_height * aspect_ratio;
-        uint8_t *resized_rgb = malloc(sizeof(uint8_t)
-            * desired_width * desired_height * 3);
-        int rc = stbir_resize_uint8(rgb, original_width, original_height, 0,
-            resized_rgb, desired_width, desired_height, 0, 3);
-        if (!rc) {
-            free(resized_rgb);
-            free(rgb);
-            return NULL;
+// Resamples one strip of output rows. Scale and offset place it in the
+// whole output, so that strips come out the same as a single resize.
+void ycc_resize_strip(void *ctx, int strip) {
+    ResizeJob *job = ctx;
+    int first = strip * job->strip_rows;
+    int rows = job->output_height - first;
+    if (rows > job->strip_rows) {
+        rows = job->strip_rows;
+    }
+
+    int rc = stbir_resize_subpixel(job->input->data,
+        job->input->width, job->input->height, job->input->stride,
+        job->output + first * job->output_width,
+        job->output_width, rows, 0,
+        STBIR_TYPE_UINT8, 1, STBIR_ALPHA_CHANNEL_NONE, 0,
+        STBIR_EDGE_CLAMP, STBIR_EDGE_CLAMP,
+        STBIR_FILTER_DEFAULT, STBIR_FILTER_DEFAULT,
+        STBIR_COLORSPACE_LINEAR, NULL,
+        job->x_scale, job->y_scale, job->x_offset, job->y_offset + first);
+    if (!rc) {
+        atomic_store(&job->failed, true);
+    }
+}
+
+// Resamples a plane with output rows split over the pool. Scales and
+// offsets place the output grid over the input as with
+// stbir_resize_subpixel, so the output may cover only part of it.
+bool ycc_resize_plane(const YCCPlane *input, uint8_t *output,
+    int output_width, int output_height, float x_scale, float y_scale,
+    float x_offset, float y_offset) {
+    ResizeJob job = {
+        input, output, output_width, output_height,
+        x_scale, y_scale, x_offset, y_offset, 0, false
+    };
+
+    int strips = tpool_threads() * RESIZE_STRIPS;
+    job.strip_rows = (output_height + strips - 1) / strips;
+    if (job.strip_rows < RESIZE_MIN_ROWS) {
+        job.strip_rows = RESIZE_MIN_ROWS;
+    }
+
+    tpool_for((output_height + job.strip_rows - 1) / job.strip_rows,
+        ycc_resize_strip, &job);
+
+    return !atomic_load(&job.failed);
+}
+
+// Largest of `max`, `max / 2`, ... 1 that still leaves twice the
+// samples of `target` in `size`.
+static int box_factor(int size, int target, int max) {
+    int factor = max;
+    while (factor > 1 && size / factor < 2 * target) {
+        factor /= 2;
+    }
+    return factor;
+}
+
+void ycc_box_row(void *ctx, int y) {
+    BoxJob *job = ctx;
+    const YCCPlane *in = job->input;
+    int y0 = y * job->box_y;
+    int y1 = y0 + job->box_y < in->height ? y0 + job->box_y : in->height;
+
+    for (int x = 0; x < job->width; x++) {
+        int x0 = x * job->box_x;
+        int x1 = x0 + job->box_x < in->width ? x0 + job->box_x : in->width;
+        int count = (x1 - x0) * (y1 - y0);
+        int sum = count / 2;
+
+        for (int sy = y0; sy < y1; sy++) {
+            const uint8_t *row = in->data + (size_t)sy * in->stride;
+            for (int sx = x0; sx < x1; sx++) {
+                sum += row[sx];
+            }
         }
 
-        original_width = desired_width;
-        original_height = desired_height;
-        free(rgb);
-        rgb = resized_rgb;
+        job->output[(size_t)y * job->width + x] = sum / count;
     }
+}
 
-    int width = original_width - (original_width % 4);
-    int height = original_height - (original_height % 2);
+// Box filters a chroma plane that is far bigger than its target size,
+// so that resizing has less to do. Returns NULL if it is not worth it,
+// or a buffer to free once `out` is done with.
+static uint8_t *ycc_box_plane(const YCCPlane *in, int target_width,
+    int target_height, YCCPlane *out) {
+    int box_x = box_factor(in->width, target_width, 4);
+    int box_y = box_factor(in->height, target_height, 2);
+    if (box_x * box_y == 1) {
+        return NULL;
+    }
+
+    out->width = (in->width + box_x - 1) / box_x;
+    out->height = (in->height + box_y - 1) / box_y;
+    out->stride = out->width;
+
+    uint8_t *data = malloc(sizeof(uint8_t) * out->width * out->height);
+    if (!data) {
+        return NULL;
+    }
+
+    BoxJob job = { in, data, out->width, box_x, box_y };
+    tpool_for(out->height, ycc_box_row, &job);
+
+    out->data = data;
+    return data;
+}
+
+/*
+ * Chroma planes may come at any resolution, each sample sitting in the
+ * middle of the area it covers. Our own samples sit on the first pixel
+ * of their 4x2 block instead, which is 3/8 of a sample left and 1/4 of
+ * a sample up from the middle.
+ */
+#define CHROMA_X_OFFSET -0.375f
+#define CHROMA_Y_OFFSET -0.25f
+
+YCCPicture *ycc_from_planes(const YCCPlane *luma, const YCCPlane *cb,
+    const YCCPlane *cr, int desired_height) {
+    // The picture is cut to whole chroma blocks, without changing scale
+    double aspect_ratio = (double)luma->width / (double)luma->height;
+    int desired_width = desired_height * aspect_ratio;
+    int width = desired_width - (desired_width % 4);
+    int height = desired_height - (desired_height % 2);
+    float x_scale = (float)desired_width / luma->width;
+    float y_scale = (float)desired_height / luma->height;
+
+    if (width < 4 || height < 2) {
+        u_error("[ycc_from_planes] Picture is too small to resize!");
+        return NULL;
+    }
 
     YCCPicture *self = ycc_new(width, height);
     if (!self) {
         return NULL;
     }
 
-    // Initialize luminance information
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            int rgb_idx = 3 * (y * original_width + x);
-            int luma_idx = y * width + x;
-            self->luma[luma_idx] = COLOR_CLAMP(16.0
-                + (65.7380 * rgb[rgb_idx + 0] / 256.0)
-                + (129.057 * rgb[rgb_idx + 1] / 256.0)
-                + (25.0640 * rgb[rgb_idx + 2] / 256.0));
+    int chroma_width = width / 4;
+    int chroma_height = height / 2;
+    bool rc = ycc_resize_plane(luma, self->luma, width, height,
+        x_scale, y_scale, 0.0f, 0.0f);
+
+    if (cb && cr) {
+        YCCPlane boxed_cb, boxed_cr;
+        uint8_t *boxed_cb_data = ycc_box_plane(cb, chroma_width, chroma_height,
+            &boxed_cb);
+        uint8_t *boxed_cr_data = ycc_box_plane(cr, chroma_width, chroma_height,
+            &boxed_cr);
+        if (boxed_cb_data && boxed_cr_data) {
+            cb = &boxed_cb;
+            cr = &boxed_cr;
         }
+
+        float chroma_x_scale = x_scale * luma->width / cb->width / 4;
+        float chroma_y_scale = y_scale * luma->height / cb->height / 2;
+
+        rc = rc
+            && ycc_resize_plane(cb, self->cb, chroma_width, chroma_height,
+                chroma_x_scale, chroma_y_scale,
+                CHROMA_X_OFFSET, CHROMA_Y_OFFSET)
+            && ycc_resize_plane(cr, self->cr, chroma_width, chroma_height,
+                chroma_x_scale, chroma_y_scale,
+                CHROMA_X_OFFSET, CHROMA_Y_OFFSET);
+
+        free(boxed_cb_data);
+        free(boxed_cr_data);
+    } else {
+        memset(self->cb, 128, chroma_width * chroma_height);
+        memset(self->cr, 128, chroma_width * chroma_height);
     }
 
-    int chroma_width = (width / 4);
-    int chroma_height = (height / 2);
+    if (!rc) {
+        u_error("[ycc_from_planes] Failed to resize planes.");
+        ycc_delete(&self);
+    }
 
-    // Now it's time for chrominance.
-    for (int cy = 0; cy < chroma_height; cy++) {
-        for (int cx = 0; cx < chroma_width; cx++) {
-            int rgb_idx = 3 * ((cy * 2) * original_width + (cx * 4));
-            int chroma_idx = cy * chroma_width + cx;
-            self->cb[chroma_idx] = COLOR_CLAMP(128.0
-                - (37.9450 * rgb[rgb_idx + 0] / 256.0)
-                - (74.4940 * rgb[rgb_idx + 1] / 256.0)
-                + (112.439 * rgb[rgb_idx + 2] / 256.0));
-            self->cr[chroma_idx] = COLOR_CLAMP(128.0
-                + (112.439 * rgb[rgb_idx + 0] / 256.0)
-                - (94.1540 * rgb[rgb_idx + 1] / 256.0)
-                - (18.2850 * rgb[rgb_idx + 2] / 256.0));
+    return self;
+}
+
+void ycc_to_planes_strip(void *ctx, int strip) {
+    PlanesJob *job = ctx;
+    int first = strip * job->strip_rows;
+    int last = first + job->strip_rows;
+    if (last > job->height) {
+        last = job->height;
+    }
+
+    // Full resolution chroma of the rows of one box
+    uint8_t *cb_rows = malloc(sizeof(uint8_t) * job->width * job->box_y * 2);
+    if (!cb_rows) {
+        u_error("[ycc_to_planes_strip] Failed to allocate chroma rows!");
+        return;
+    }
+    uint8_t *cr_rows = cb_rows + job->width * job->box_y;
+
+    for (int y = first; y < last; y += job->box_y) {
+        int rows = last - y < job->box_y ? last - y : job->box_y;
+
+        for (int i = 0; i < rows; i++) {
+            size_t offset = (size_t)(y + i) * job->width;
+            conv_rgb_to_ycc_full_row(job->rgb + 3 * offset,
+                job->luma + offset, cb_rows + i * job->width,
+                cr_rows + i * job->width, job->width);
+        }
+
+        size_t chroma_row = (size_t)(y / job->box_y) * job->chroma_width;
+        for (int cx = 0; cx < job->chroma_width; cx++) {
+            int x0 = cx * job->box_x;
+            int x1 = x0 + job->box_x < job->width ? x0 + job->box_x : job->width;
+            int count = (x1 - x0) * rows;
+            int u = count / 2;
+            int v = count / 2;
+
+            for (int i = 0; i < rows; i++) {
+                for (int x = x0; x < x1; x++) {
+                    u += cb_rows[i * job->width + x];
+                    v += cr_rows[i * job->width + x];
+                }
+            }
+
+            job->cb[chroma_row + cx] = u / count;
+            job->cr[chroma_row + cx] = v / count;
         }
     }
 
-    stbi_image_free(rgb);
+    free(cb_rows);
+}
 
+// Converts RGB to planes and resizes those. Chroma is box filtered
+// in the same pass, the way ycc_box_plane would do it afterwards.
+static YCCPicture *ycc_resize_rgb(const uint8_t *rgb, int width, int height,
+    int desired_height) {
+    double aspect_ratio = (double)width / (double)height;
+    int chroma_width = (int)(desired_height * aspect_ratio) / 4;
+    int chroma_height = desired_height / 2;
+    int box_x = box_factor(width, chroma_width, 4);
+    int box_y = box_factor(height, chroma_height, 2);
+
+    PlanesJob job = {
+        rgb, width, height, NULL, NULL, NULL,
+        (width + box_x - 1) / box_x, box_x, box_y,
+        strip_rows(width * 4)
+    };
+
+    size_t luma_size = (size_t)width * height;
+    size_t chroma_size = (size_t)job.chroma_width
+        * ((height + box_y - 1) / box_y);
+    job.luma = malloc(sizeof(uint8_t) * (luma_size + 2 * chroma_size));
+    if (!job.luma) {
+        u_error("[ycc_resize_rgb] Failed to allocate planes!");
+        return NULL;
+    }
+    job.cb = job.luma + luma_size;
+    job.cr = job.cb + chroma_size;
+
+    tpool_for((height + job.strip_rows - 1) / job.strip_rows,
+        ycc_to_planes_strip, &job);
+
+    YCCPlane luma = { job.luma, width, height, width };
+    YCCPlane cb = {
+        job.cb, job.chroma_width, chroma_size / job.chroma_width,
+        job.chroma_width
+    };
+    YCCPlane cr = cb;
+    cr.data = job.cr;
+
+    YCCPicture *self = ycc_from_planes(&luma, &cb, &cr, desired_height);
+
+    free(job.luma);
     return self;
 }
 
-void ycbcr_to_rgb(uint8_t *dest, uint8_t luma, uint8_t cb, uint8_t cr) {
-    dest[0] = COLOR_CLAMP(0.0
-        + (298.082 * luma / 256.0)
-        + (408.583 * cr / 256.0)
-        - 222.921);
-    dest[1] = COLOR_CLAMP(0.0
-        + (298.082 * luma / 256.0)
-        - (100.291 * cb / 256.0)
-        - (208.120 * cr / 256.0)
-        + 135.576);
-    dest[2] = COLOR_CLAMP(0.0
-        + (298.082 * luma / 256.0)
-        + (516.412 * cb / 256.0)
-        - 276.836);
+void ycc_from_rgb_strip(void *ctx, int strip) {
+    ConvertJob *job = ctx;
+    YCCPicture *self = job->picture;
+    int chroma_width = (self->width / 4);
+    int first = strip * job->strip_rows;
+    int last = first + job->strip_rows;
+    if (last > self->height) {
+        last = self->height;
+    }
+
+    // Luminance and chrominance go in one pass, chrominance is taken
+    // from every 4th pixel of even rows.
+    for (int y = first; y < last; y++) {
+        const uint8_t *rgb_row = job->rgb + 3 * y * job->rgb_width;
+        uint8_t *luma_row = self->luma + y * self->width;
+
+        if (y % 2 == 0) {
+            int chroma_idx = (y / 2) * chroma_width;
+            conv_rgb_to_ycc_row(rgb_row, luma_row,
+                self->cb + chroma_idx, self->cr + chroma_idx, self->width);
+        } else {
+            conv_rgb_to_ycc_row(rgb_row, luma_row, NULL, NULL, self->width);
+        }
+    }
+}
+
+YCCPicture *ycc_decode_picture(const uint8_t *data, size_t length,
+    int desired_height) {
+    // JPEG is YCbCr already, its planes go straight in or to the resize
+    bool failed;
+    YCCPicture *self = jpeg_read(data, length, desired_height, &failed,
+        NULL);
+    if (self || failed) {
+        return self;
+    }
+
+    int original_width;
+    int original_height;
+    uint8_t *rgb = stbi_load_from_memory(data, length,
+        &original_width, &original_height, NULL, 3);
+    if (!rgb) {
+        u_error("[ycbcr_decode_picture] STBI failed: %s", stbi_failure_reason());
+        return NULL;
+    }
+
+    // Resizing is done in YCbCr, chroma goes right to its own resolution
+    if (desired_height > 0) {
+        self = ycc_resize_rgb(rgb, original_width, original_height,
+            desired_height);
+        stbi_image_free(rgb);
+        return self;
+    }
+
+    int width = original_width - (original_width % 4);
+    int height = original_height - (original_height % 2);
+
+    self = ycc_new(width, height);
+    if (!self) {
+        stbi_image_free(rgb);
+        return NULL;
+    }
+
+    ConvertJob job = { rgb, original_width, self, strip_rows(width * 4) };
+    tpool_for((height + job.strip_rows - 1) / job.strip_rows,
+        ycc_from_rgb_strip, &job);
+
+    stbi_image_free(rgb);
+
+    return self;
 }
 
 void _ycc_stbi_write(void *file, void *data, int size) {
     fwrite(data, 1, size, (FILE *)file);
 }
 
-bool ycc_save_picture(const YCCPicture *self, const char *path, const char *fext) {
-    uint8_t *rgb = malloc(sizeof(uint8_t) * self->width * self->height * 3);
+void ycc_to_rgb_strip(void *ctx, int strip) {
+    ConvertJob *job = ctx;
+    const YCCPicture *self = job->picture;
+    int chroma_width = self->width / 4;
+    int first = strip * job->strip_rows;
+    int last = first + job->strip_rows;
+    if (last > self->height) {
+        last = self->height;
+    }
+
+    for (int y = first; y < last; y++) {
+        // Odd rows lie halfway between two chroma rows, except the last one
+        int top = (y / 2) * chroma_width;
+        int bottom = (y % 2 == 1 && y < self->height - 1)
+            ? top + chroma_width
+            : top;
+
+        conv_ycc_to_rgb_row(self->luma + y * self->width,
+            self->cb + top, self->cr + top,
+            self->cb + bottom, self->cr + bottom,
+            job->rgb + y * 3 * self->width, self->width);
+    }
+}
+
+// Returns a buffer from the RGB pool, give it back with bufpool_put.
+uint8_t *ycc_to_rgb(const YCCPicture *self) {
+    uint8_t *rgb = bufpool_get(&rgb_pool,
+        sizeof(uint8_t) * self->width * self->height * 3);
     if (!rgb) {
         u_error("[ycbcr_save_picture] Failed to allocate memory for RGB data!");
-        return false;
+        return NULL;
     }
 
-    for (int y = 0; y < self->height; y++) {
-        for (int x = 0; x < self->width; x++) {
-            int rgb_idx = y * 3 * self->width + x * 3;
-            int luma_idx = y * self->width + x;
-            int chroma_idx = (y / 2) * (self->width / 4) + (x / 4);
-            int chroma_lidx = (y == (self->height - 1))
-                ? chroma_idx
-                : chroma_idx + (self->width / 4);
-
-            double s = (double)(x % 4) / 4.0;
-            double t = (double)(y % 2) / 2.0;
-            uint8_t cb;
-            uint8_t cr;
-
-            cb = BILERP(
-                self->cb[chroma_idx], self->cb[chroma_idx + 1],
-                self->cb[chroma_lidx], self->cb[chroma_lidx + 1],
-                s, t
-            );
-            cr = BILERP(
-                self->cr[chroma_idx], self->cr[chroma_idx + 1],
-                self->cr[chroma_lidx], self->cr[chroma_lidx + 1],
-                s, t
-            );
-            ycbcr_to_rgb(&rgb[rgb_idx], self->luma[luma_idx], cb, cr);
-        }
-    }
+    ConvertJob job = { rgb, self->width, (YCCPicture *)self,
+        strip_rows(self->width * 4) };
+    tpool_for((self->height + job.strip_rows - 1) / job.strip_rows,
+        ycc_to_rgb_strip, &job);
+
+    return rgb;
+}
 
+bool ycc_save_picture(const YCCPicture *self, const char *path, const char *fext) {
     FILE *file;
     const char *ext;
 
@@ -196,48 +590,82 @@ bool ycc_save_picture(const YCCPicture *self, const char *path, const char *fext
         file = stdout;
         ext = fext;
     } else {
+        ext = fext ? fext : u_get_file_ext(path);
+
+        // Sizes of these are known, so they're written into a mapped file
+        if (ext && strcmp(ext, "bmp") == 0) {
+            return bitmap_write(self, path, BITMAP_BMP);
+        } else if (ext && strcmp(ext, "tga") == 0) {
+            return bitmap_write(self, path, BITMAP_TGA);
+        }
+
         file = fopen(path, "wb");
         if (!file) {
             u_error("Unable to open \"%s\" for write.", path);
             return false;
         }
-        ext = fext ? fext : u_get_file_ext(path);
     }
 
     bool rc = false;
+    uint8_t *rgb = NULL;
+    RawLayout layout;
 
     if (!ext) {
         u_error("Please provide output extension!");
     } else if (strcmp(ext, "jpg") == 0 || strcmp(ext, "jpeg") == 0) {
-        rc = stbi_write_jpg_to_func(_ycc_stbi_write, (void *)file,
-            self->width, self->height, 3, rgb, JPEG_QUALITY);
+        // JPEG is YCbCr already, so the planes go to the encoder as is
+        rc = jpeg_write(self, _ycc_stbi_write, (void *)file, JPEG_QUALITY,
+            NULL);
     } else if (strcmp(ext, "png") == 0) {
-        rc = stbi_write_png_to_func(_ycc_stbi_write, (void *)file,
-            self->width, self->height, 3, rgb, PNG_STRIDE);
+        if ((rgb = ycc_to_rgb(self))) {
+            rc = stbi_write_png_to_func(_ycc_stbi_write, (void *)file,
+                self->width, self->height, 3, rgb, PNG_STRIDE);
+        }
     } else if (strcmp(ext, "bmp") == 0) {
-        rc = stbi_write_bmp_to_func(_ycc_stbi_write, (void *)file,
-            self->width, self->height, 3, rgb);
+        if ((rgb = ycc_to_rgb(self))) {
+            rc = stbi_write_bmp_to_func(_ycc_stbi_write, (void *)file,
+                self->width, self->height, 3, rgb);
+        }
     } else if (strcmp(ext, "tga") == 0) {
-        rc = stbi_write_tga_to_func(_ycc_stbi_write, (void *)file,
-            self->width, self->height, 3, rgb);
+        if ((rgb = ycc_to_rgb(self))) {
+            rc = stbi_write_tga_to_func(_ycc_stbi_write, (void *)file,
+                self->width, self->height, 3, rgb);
+        }
+    } else if (raw_parse_layout(ext, &layout)) {
+        rc = raw_write_frame(self, layout, file);
     } else {
         u_error("Unknown output extension %s!", ext);
     }
 
     fclose(file);
-    free(rgb);
+    bufpool_put(&rgb_pool, rgb);
 
     return rc;
 }
 
 void ycc_copy(YCCPicture *dst, const YCCPicture *src) {
-    size_t luma_size = src->width * src->height * sizeof(uint8_t);
-    size_t chroma_size = (src->width / 4) * (src->height / 2) * sizeof(uint8_t);
+    size_t luma_size = (size_t)src->width * src->height;
+    size_t chroma_size = (size_t)(src->width / 4) * (src->height / 2);
+
+    if (atomic_load(dst->luma_refs) > 1
+        || dst->width != src->width || dst->height != src->height) {
+        if (!ycc_detach_luma(dst, luma_size, false)) {
+            return;
+        }
+    }
 
     if (dst->width != src->width || dst->height != src->height) {
-        dst->luma = realloc(dst->luma, luma_size);
-        dst->cb = realloc(dst->cb, chroma_size);
-        dst->cr = realloc(dst->cr, chroma_size);
+        uint8_t *cb = bufpool_get(&chroma_pool, chroma_size);
+        uint8_t *cr = bufpool_get(&chroma_pool, chroma_size);
+        if (!cb || !cr) {
+            bufpool_put(&chroma_pool, cb);
+            bufpool_put(&chroma_pool, cr);
+            return;
+        }
+        bufpool_put(&chroma_pool, dst->cb);
+        bufpool_put(&chroma_pool, dst->cr);
+        dst->cb = cb;
+        dst->cr = cr;
     }
 
     memcpy(dst->luma, src->luma, luma_size);
@@ -245,7 +673,44 @@ void ycc_copy(YCCPicture *dst, const YCCPicture *src) {
     memcpy(dst->cr, src->cr, chroma_size);
 
     dst->width = src->width;
-    dst->height = dst->height;
+    dst->height = src->height;
+}
+
+/*
+ * Makes a picture that uses the luma plane of `src` instead of a copy of
+ * it. Chroma is copied as usual. Call ycc_own_luma before writing to the
+ * luma of either picture.
+ */
+YCCPicture *ycc_share(const YCCPicture *src) {
+    YCCPicture *self = malloc(sizeof(YCCPicture));
+    if (!self) {
+        u_error("[ycc_share] Failed to allocate YCbCrPicture structure.");
+        return NULL;
+    }
+
+    size_t chroma_size = (size_t)(src->width / 4) * (src->height / 2);
+
+    self->width = src->width;
+    self->height = src->height;
+    self->cb = bufpool_get(&chroma_pool, chroma_size);
+    self->cr = bufpool_get(&chroma_pool, chroma_size);
+
+    if (!self->cb || !self->cr) {
+        u_error("[ycc_share] Failed to allocate chroma planes!");
+        bufpool_put(&chroma_pool, self->cb);
+        bufpool_put(&chroma_pool, self->cr);
+        free(self);
+        return NULL;
+    }
+
+    memcpy(self->cb, src->cb, chroma_size);
+    memcpy(self->cr, src->cr, chroma_size);
+
+    atomic_fetch_add(src->luma_refs, 1);
+    self->luma = src->luma;
+    self->luma_refs = src->luma_refs;
+
+    return self;
 }
 
 bool ycc_merge(YCCPicture *base, YCCPicture *add) {
@@ -253,6 +718,10 @@ bool ycc_merge(YCCPicture *base, YCCPicture *add) {
         u_error("[ycbcr_merge] Only pictures of the same size can be merged!");
         return false;
     }
+
+    if (!ycc_own_luma(base)) {
+        return false;
+    }
     
     for (int y = 0; y < base->height; y++) {
         for (int x = 0; x < base->width; x++) {
@@ -281,10 +750,17 @@ bool ycc_merge(YCCPicture *base, YCCPicture *add) {
 void ycc_delete(YCCPicture **selfp) {
     YCCPicture *self = *selfp;
 
-    free(self->luma);
-    free(self->cb);
-    free(self->cr);
+    ycc_release_luma(self);
+    bufpool_put(&chroma_pool, self->cb);
+    bufpool_put(&chroma_pool, self->cr);
     free(self);
 
     *selfp = NULL;
 }
+
+void ycc_release_pools(void) {
+    bufpool_drain(&luma_pool);
+    bufpool_drain(&chroma_pool);
+    bufpool_drain(&rgb_pool);
+    bufpool_drain(&resize_pool);
+}
@@ -2,26 +2,44 @@
 #ifndef __PICTURE_H_
 #define __PICTURE_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 
 #define COLOR_CLAMP(x) ((x) < 0 ? 0 : ((x) > 255 ? 255 : (x)))
 
 typedef struct {
-    uint8_t     *luma; // width * height
+    uint8_t     *luma; // width * height, may be shared with other pictures
+    atomic_int  *luma_refs; // count of pictures sharing `luma`
     uint8_t     *cb; // (width / 4) * (height / 2)
     uint8_t     *cr; // (width / 4) * (height / 2)
     int         width;
     int         height;
 } YCCPicture;
 
+// A plane of samples as a decoder hands it over
+typedef struct {
+    const uint8_t   *data;
+    int             width;
+    int             height;
+    int             stride; // bytes from one row to the next
+} YCCPlane;
+
 YCCPicture *ycc_new(int width, int height);
+YCCPicture *ycc_from_planes(const YCCPlane *luma, const YCCPlane *cb,
+    const YCCPlane *cr, int desired_height);
 void ycc_reset(YCCPicture *self);
 YCCPicture *ycc_load_picture(const char *path, int desired_height);
+YCCPicture *ycc_decode_picture(const uint8_t *data, size_t length,
+    int desired_height);
 bool ycc_save_picture(const YCCPicture *self, const char *path, const char *fext);
 void ycc_copy(YCCPicture *dst, const YCCPicture *src);
+YCCPicture *ycc_share(const YCCPicture *src);
+bool ycc_own_luma(YCCPicture *self);
 bool ycc_merge(YCCPicture *base, YCCPicture *add);
 void ycc_delete(YCCPicture **selfp);
+void ycc_release_pools(void);
 
 #endif
 
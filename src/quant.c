@@ -0,0 +1,367 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "quant.h"
+#include "tpool.h"
+#include "util.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define QUANT_X86
+#include <immintrin.h>
+#endif
+
+#define HIST_BITS   5
+#define HIST_SIZE   (1 << (3 * HIST_BITS))
+#define TABLE_SIDE  (1 << QUANT_BITS)
+
+typedef struct {
+    uint8_t     c[3]; // upper HIST_BITS bits of R, G and B
+    uint32_t    count;
+    uint64_t    sum[3];
+} QuantBin;
+
+typedef struct {
+    int         first;
+    int         last; // one past the last bin
+    uint64_t    count;
+    int         axis; // widest channel
+    int         range; // of that channel
+} QuantBox;
+
+/*
+ * Finds the nearest palette colour of `count` packed RGB colours. The
+ * vector paths take 4 or 8 colours at once against one palette colour
+ * after another, keeping the best one of each in its own lane.
+ */
+typedef void (*NearestFunc)(const Quantizer *self, const int32_t *rg,
+    const int32_t *b, int count, uint8_t *indices);
+
+static NearestFunc nearest;
+static pthread_once_t selected = PTHREAD_ONCE_INIT;
+
+// R and G as 16-bit halves of a 32-bit lane, so that one _mm_madd_epi16
+// of a difference with itself is the sum of both squares.
+static inline int32_t pack_rg(int r, int g) {
+    return (int32_t)((uint32_t)r | ((uint32_t)g << 16));
+}
+
+static void nearest_scalar(const Quantizer *self, const int32_t *rg,
+    const int32_t *b, int count, uint8_t *indices) {
+    for (int j = 0; j < count; j++) {
+        int r = (int16_t)(rg[j] & 0xFFFF);
+        int g = (int16_t)(rg[j] >> 16);
+        int32_t best = INT32_MAX;
+
+        for (int i = 0; i < self->count; i++) {
+            int dr = r - self->palette[i][0];
+            int dg = g - self->palette[i][1];
+            int db = b[j] - self->palette[i][2];
+            int32_t d = dr * dr + dg * dg + db * db;
+            if (d < best) {
+                best = d;
+                indices[j] = i;
+            }
+        }
+    }
+}
+
+#ifdef QUANT_X86
+
+__attribute__((target("sse2")))
+static void nearest_sse2(const Quantizer *self, const int32_t *rg,
+    const int32_t *b, int count, uint8_t *indices) {
+    int j;
+
+    for (j = 0; j + 4 <= count; j += 4) {
+        __m128i qrg = _mm_loadu_si128((const __m128i *)(rg + j));
+        __m128i qb = _mm_loadu_si128((const __m128i *)(b + j));
+        __m128i best = _mm_set1_epi32(INT32_MAX);
+        __m128i index = _mm_setzero_si128();
+
+        for (int i = 0; i < self->count; i++) {
+            const uint8_t *p = self->palette[i];
+            __m128i drg = _mm_sub_epi16(qrg,
+                _mm_set1_epi32(pack_rg(p[0], p[1])));
+            __m128i db = _mm_sub_epi16(qb, _mm_set1_epi32(p[2]));
+            __m128i d = _mm_add_epi32(_mm_madd_epi16(drg, drg),
+                _mm_madd_epi16(db, db));
+
+            __m128i closer = _mm_cmplt_epi32(d, best);
+            best = _mm_or_si128(_mm_and_si128(closer, d),
+                _mm_andnot_si128(closer, best));
+            index = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(i)),
+                _mm_andnot_si128(closer, index));
+        }
+
+        int32_t lanes[4];
+        _mm_storeu_si128((__m128i *)lanes, index);
+        for (int k = 0; k < 4; k++) {
+            indices[j + k] = lanes[k];
+        }
+    }
+
+    nearest_scalar(self, rg + j, b + j, count - j, indices + j);
+}
+
+__attribute__((target("avx2")))
+static void nearest_avx2(const Quantizer *self, const int32_t *rg,
+    const int32_t *b, int count, uint8_t *indices) {
+    int j;
+
+    for (j = 0; j + 8 <= count; j += 8) {
+        __m256i qrg = _mm256_loadu_si256((const __m256i *)(rg + j));
+        __m256i qb = _mm256_loadu_si256((const __m256i *)(b + j));
+        __m256i best = _mm256_set1_epi32(INT32_MAX);
+        __m256i index = _mm256_setzero_si256();
+
+        for (int i = 0; i < self->count; i++) {
+            const uint8_t *p = self->palette[i];
+            __m256i drg = _mm256_sub_epi16(qrg,
+                _mm256_set1_epi32(pack_rg(p[0], p[1])));
+            __m256i db = _mm256_sub_epi16(qb, _mm256_set1_epi32(p[2]));
+            __m256i d = _mm256_add_epi32(_mm256_madd_epi16(drg, drg),
+                _mm256_madd_epi16(db, db));
+
+            __m256i closer = _mm256_cmpgt_epi32(best, d);
+            best = _mm256_min_epi32(best, d);
+            index = _mm256_blendv_epi8(index, _mm256_set1_epi32(i), closer);
+        }
+
+        int32_t lanes[8];
+        _mm256_storeu_si256((__m256i *)lanes, index);
+        for (int k = 0; k < 8; k++) {
+            indices[j + k] = lanes[k];
+        }
+    }
+
+    nearest_scalar(self, rg + j, b + j, count - j, indices + j);
+}
+
+#endif
+
+static void quant_select(void) {
+    nearest = nearest_scalar;
+
+#ifdef QUANT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        nearest = nearest_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        nearest = nearest_sse2;
+    }
+#endif
+}
+
+static void quant_measure(const QuantBin *bins, QuantBox *box) {
+    int lo[3] = { 255, 255, 255 };
+    int hi[3] = { 0, 0, 0 };
+
+    box->count = 0;
+    for (int i = box->first; i < box->last; i++) {
+        for (int ch = 0; ch < 3; ch++) {
+            if (bins[i].c[ch] < lo[ch]) {
+                lo[ch] = bins[i].c[ch];
+            }
+            if (bins[i].c[ch] > hi[ch]) {
+                hi[ch] = bins[i].c[ch];
+            }
+        }
+        box->count += bins[i].count;
+    }
+
+    box->axis = 0;
+    for (int ch = 1; ch < 3; ch++) {
+        if (hi[ch] - lo[ch] > hi[box->axis] - lo[box->axis]) {
+            box->axis = ch;
+        }
+    }
+    box->range = hi[box->axis] - lo[box->axis];
+}
+
+static int compare_r(const void *a, const void *b) {
+    return ((const QuantBin *)a)->c[0] - ((const QuantBin *)b)->c[0];
+}
+
+static int compare_g(const void *a, const void *b) {
+    return ((const QuantBin *)a)->c[1] - ((const QuantBin *)b)->c[1];
+}
+
+static int compare_b(const void *a, const void *b) {
+    return ((const QuantBin *)a)->c[2] - ((const QuantBin *)b)->c[2];
+}
+
+// Splits boxes until there are `colors` of them or none can be split.
+// The box split next is the one with the most pixels times its widest
+// range, at the median pixel along that range.
+static int quant_median_cut(QuantBin *bins, int bin_count, QuantBox *boxes,
+    int colors) {
+    static int (*const compare[3])(const void *, const void *) = {
+        compare_r, compare_g, compare_b
+    };
+    int count = 1;
+
+    boxes[0].first = 0;
+    boxes[0].last = bin_count;
+    quant_measure(bins, &boxes[0]);
+
+    while (count < colors) {
+        QuantBox *box = NULL;
+        for (int i = 0; i < count; i++) {
+            if (boxes[i].range > 0 && (!box || boxes[i].count
+                * boxes[i].range > box->count * box->range)) {
+                box = &boxes[i];
+            }
+        }
+        if (!box) {
+            break;
+        }
+
+        qsort(bins + box->first, box->last - box->first, sizeof(QuantBin),
+            compare[box->axis]);
+
+        // The range is not empty, so the split leaves bins on both sides
+        uint64_t half = box->count / 2;
+        uint64_t below = 0;
+        int split = box->first;
+        while (split < box->last - 1 && below + bins[split].count <= half) {
+            below += bins[split].count;
+            split++;
+        }
+        if (split == box->first) {
+            split++;
+        }
+
+        QuantBox *other = &boxes[count++];
+        other->first = split;
+        other->last = box->last;
+        box->last = split;
+        quant_measure(bins, box);
+        quant_measure(bins, other);
+    }
+
+    return count;
+}
+
+static bool quant_palette(Quantizer *self, const uint8_t *rgb, size_t pixels,
+    int colors) {
+    QuantBin *bins = calloc(HIST_SIZE, sizeof(QuantBin));
+    QuantBox *boxes = malloc(sizeof(QuantBox) * colors);
+    if (!bins || !boxes) {
+        free(bins);
+        free(boxes);
+        return false;
+    }
+
+    const int shift = 8 - HIST_BITS;
+    for (size_t i = 0; i < pixels; i++, rgb += 3) {
+        QuantBin *bin = &bins[(rgb[0] >> shift) << (2 * HIST_BITS)
+            | (rgb[1] >> shift) << HIST_BITS | (rgb[2] >> shift)];
+        bin->count++;
+        bin->sum[0] += rgb[0];
+        bin->sum[1] += rgb[1];
+        bin->sum[2] += rgb[2];
+    }
+
+    // Only the colours that are there take part
+    int bin_count = 0;
+    for (int i = 0; i < HIST_SIZE; i++) {
+        if (bins[i].count) {
+            bins[bin_count] = bins[i];
+            bins[bin_count].c[0] = i >> (2 * HIST_BITS);
+            bins[bin_count].c[1] = (i >> HIST_BITS) & ((1 << HIST_BITS) - 1);
+            bins[bin_count].c[2] = i & ((1 << HIST_BITS) - 1);
+            bin_count++;
+        }
+    }
+
+    self->count = bin_count
+        ? quant_median_cut(bins, bin_count, boxes, colors)
+        : 0;
+    for (int i = 0; i < self->count; i++) {
+        uint64_t sum[3] = { 0, 0, 0 };
+        for (int j = boxes[i].first; j < boxes[i].last; j++) {
+            for (int ch = 0; ch < 3; ch++) {
+                sum[ch] += bins[j].sum[ch];
+            }
+        }
+        for (int ch = 0; ch < 3; ch++) {
+            self->palette[i][ch] = (sum[ch] + boxes[i].count / 2)
+                / boxes[i].count;
+        }
+    }
+
+    free(bins);
+    free(boxes);
+
+    return true;
+}
+
+// Fills the part of the table where R is `r`, from the middle of each
+// cell of the colour cube.
+void quant_table_slice(void *ctx, int r) {
+    Quantizer *self = ctx;
+    const int half = 1 << (7 - QUANT_BITS);
+    int32_t rg[TABLE_SIDE * TABLE_SIDE];
+    int32_t b[TABLE_SIDE * TABLE_SIDE];
+
+    for (int g = 0; g < TABLE_SIDE; g++) {
+        for (int k = 0; k < TABLE_SIDE; k++) {
+            rg[g * TABLE_SIDE + k] = pack_rg(
+                (r << (8 - QUANT_BITS)) + half,
+                (g << (8 - QUANT_BITS)) + half);
+            b[g * TABLE_SIDE + k] = (k << (8 - QUANT_BITS)) + half;
+        }
+    }
+
+    nearest(self, rg, b, TABLE_SIDE * TABLE_SIDE,
+        self->table + r * TABLE_SIDE * TABLE_SIDE);
+}
+
+Quantizer *quant_new(const uint8_t *rgb, size_t pixels, int colors) {
+    Quantizer *self = calloc(1, sizeof(Quantizer));
+    if (!self) {
+        u_error("[quant_new] Failed to allocate Quantizer structure.");
+        return NULL;
+    }
+
+    self->table = malloc(TABLE_SIDE * TABLE_SIDE * TABLE_SIDE);
+    if (colors > 256) {
+        colors = 256;
+    }
+    if (!self->table || colors < 1
+        || !quant_palette(self, rgb, pixels, colors)) {
+        u_error("[quant_new] Failed to build a palette.");
+        quant_delete(&self);
+        return NULL;
+    }
+
+    pthread_once(&selected, quant_select);
+    if (self->count > 0) {
+        tpool_for(TABLE_SIDE, quant_table_slice, self);
+    } else {
+        memset(self->table, 0, TABLE_SIDE * TABLE_SIDE * TABLE_SIDE);
+    }
+
+    return self;
+}
+
+void quant_map_row(const Quantizer *self, const uint8_t *rgb,
+    uint8_t *indices, int width) {
+    const int shift = 8 - QUANT_BITS;
+
+    for (int x = 0; x < width; x++, rgb += 3) {
+        indices[x] = self->table[(rgb[0] >> shift) << (2 * QUANT_BITS)
+            | (rgb[1] >> shift) << QUANT_BITS | (rgb[2] >> shift)];
+    }
+}
+
+void quant_delete(Quantizer **selfp) {
+    Quantizer *self = *selfp;
+
+    free(self->table);
+    free(self);
+    *selfp = NULL;
+}
+
@@ -0,0 +1,31 @@
+#ifndef __QUANT_H_
+#define __QUANT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define QUANT_BITS  6 // of each channel in the lookup table
+
+/*
+ * A palette of up to 256 colours cut out of one picture by median cut,
+ * and the nearest of them to every colour, looked up by the upper
+ * QUANT_BITS bits of each channel.
+ */
+typedef struct {
+    uint8_t     palette[256][3];
+    int         count;
+    uint8_t     *table;
+} Quantizer;
+
+// Makes a palette of at most `colors` colours for `pixels` packed RGB
+// pixels of `rgb`.
+Quantizer *quant_new(const uint8_t *rgb, size_t pixels, int colors);
+
+// Replaces `width` RGB pixels with indices of their palette colours.
+void quant_map_row(const Quantizer *self, const uint8_t *rgb,
+    uint8_t *indices, int width);
+
+void quant_delete(Quantizer **selfp);
+
+#endif
+
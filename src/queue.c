@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+
+#include "queue.h"
+#include "util.h"
+
+#define SPIN_COUNT      64
+#define MAX_SLEEP_NS    1000000
+
+Queue *queue_new(size_t capacity) {
+    Queue *self = malloc(sizeof(Queue));
+    if (!self) {
+        u_error("[queue_new] Failed to allocate Queue structure.");
+        return NULL;
+    }
+
+    self->slots = malloc(sizeof(void *) * capacity);
+    if (!self->slots) {
+        u_error("[queue_new] Failed to allocate %zu slots!", capacity);
+        free(self);
+        return NULL;
+    }
+
+    self->capacity = capacity;
+    atomic_init(&self->head, 0);
+    atomic_init(&self->tail, 0);
+
+    return self;
+}
+
+// Backs off a bit more on every call while the other end is busy.
+static void queue_wait(int *round) {
+    if (*round < SPIN_COUNT) {
+        sched_yield();
+    } else {
+        long ns = 1000L << (*round - SPIN_COUNT < 10 ? *round - SPIN_COUNT : 10);
+        struct timespec ts = { 0, ns < MAX_SLEEP_NS ? ns : MAX_SLEEP_NS };
+        nanosleep(&ts, NULL);
+    }
+    (*round)++;
+}
+
+void queue_push(Queue *self, void *item) {
+    size_t tail = atomic_load_explicit(&self->tail, memory_order_relaxed);
+    int round = 0;
+
+    while (tail - atomic_load_explicit(&self->head, memory_order_acquire)
+        == self->capacity) {
+        queue_wait(&round);
+    }
+
+    self->slots[tail % self->capacity] = item;
+    atomic_store_explicit(&self->tail, tail + 1, memory_order_release);
+}
+
+void *queue_pop(Queue *self) {
+    size_t head = atomic_load_explicit(&self->head, memory_order_relaxed);
+    int round = 0;
+
+    while (atomic_load_explicit(&self->tail, memory_order_acquire) == head) {
+        queue_wait(&round);
+    }
+
+    void *item = self->slots[head % self->capacity];
+    atomic_store_explicit(&self->head, head + 1, memory_order_release);
+
+    return item;
+}
+
+void queue_delete(Queue **selfp) {
+    Queue *self = *selfp;
+
+    free(self->slots);
+    free(self);
+
+    *selfp = NULL;
+}
+
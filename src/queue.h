@@ -0,0 +1,26 @@
+#ifndef __QUEUE_H_
+#define __QUEUE_H_
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+/*
+ * A bounded lock-free ring of pointers for exactly one producer thread
+ * and one consumer thread. Both ends wait (spinning, then sleeping) when
+ * the ring is full or empty. NULL is a valid item; pipelines use it to
+ * mark the end of the stream.
+ */
+typedef struct {
+    void            **slots;
+    size_t          capacity;
+    atomic_size_t   head; // next slot to pop
+    atomic_size_t   tail; // next slot to push
+} Queue;
+
+Queue *queue_new(size_t capacity);
+void queue_push(Queue *self, void *item);
+void *queue_pop(Queue *self);
+void queue_delete(Queue **selfp);
+
+#endif
+
@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "raw.h"
+#include "util.h"
+
+bool raw_parse_layout(const char *name, RawLayout *layout) {
+    if (strcmp(name, "i420") == 0 || strcmp(name, "yuv") == 0) {
+        *layout = RAW_I420;
+    } else if (strcmp(name, "nv12") == 0) {
+        *layout = RAW_NV12;
+    } else if (strcmp(name, "yuv4x2") == 0) {
+        *layout = RAW_YUV4X2;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// Samples per row and rows of each chroma plane, or of the Cb Cr pairs.
+static void raw_chroma_size(RawLayout layout, int width, int height,
+    int *chroma_width, int *chroma_height) {
+    *chroma_width = layout == RAW_YUV4X2 ? (width + 3) / 4 : (width + 1) / 2;
+    *chroma_height = (height + 1) / 2;
+}
+
+size_t raw_frame_size(RawLayout layout, int width, int height) {
+    int chroma_width, chroma_height;
+    raw_chroma_size(layout, width, height, &chroma_width, &chroma_height);
+
+    return (size_t)width * height + 2 * (size_t)chroma_width * chroma_height;
+}
+
+// Our chroma sample sits at the first pixel of four, which is where
+// half width samples 2 cx - 1, 2 cx and 2 cx + 1 meet. `step` is 2 for
+// interleaved pairs.
+static void raw_narrow_chroma(const uint8_t *in, int in_width, int step,
+    uint8_t *out, int out_width) {
+    for (int cx = 0; cx < out_width; cx++) {
+        int x = 2 * cx;
+        int left = x > 0 ? in[(x - 1) * step] : in[x * step];
+        int right = x + 1 < in_width ? in[(x + 1) * step] : in[x * step];
+
+        out[cx] = (left + 2 * in[x * step] + right + 2) / 4;
+    }
+}
+
+// Half width sample x sits at pixel 2 x + 0.5, between our samples
+// which sit at every 4th pixel.
+static void raw_widen_chroma(const uint8_t *in, int in_width, uint8_t *out,
+    int out_width, int step) {
+    for (int x = 0; x < out_width; x++) {
+        int cx = x / 2;
+        int next = cx + 1 < in_width ? cx + 1 : cx;
+
+        out[x * step] = x % 2 == 0
+            ? (7 * in[cx] + in[next] + 4) / 8
+            : (3 * in[cx] + 5 * in[next] + 4) / 8;
+    }
+}
+
+// Resizes through ycc_from_planes, which wants planes of their own.
+static YCCPicture *raw_resize(const uint8_t *frame, RawLayout layout,
+    int width, int height, int desired_height) {
+    int chroma_width, chroma_height;
+    raw_chroma_size(layout, width, height, &chroma_width, &chroma_height);
+    size_t chroma_size = (size_t)chroma_width * chroma_height;
+
+    YCCPlane luma = { frame, width, height, width };
+    YCCPlane cb = { frame + (size_t)width * height, chroma_width,
+        chroma_height, chroma_width };
+    YCCPlane cr = { cb.data + chroma_size, chroma_width, chroma_height,
+        chroma_width };
+
+    uint8_t *pairs = NULL;
+    if (layout == RAW_NV12) {
+        pairs = malloc(2 * chroma_size);
+        if (!pairs) {
+            u_error("[raw_resize] Failed to allocate chroma planes!");
+            return NULL;
+        }
+
+        for (size_t i = 0; i < chroma_size; i++) {
+            pairs[i] = cb.data[2 * i];
+            pairs[chroma_size + i] = cb.data[2 * i + 1];
+        }
+        cb.data = pairs;
+        cr.data = pairs + chroma_size;
+    }
+
+    YCCPicture *self = ycc_from_planes(&luma, &cb, &cr, desired_height);
+    free(pairs);
+
+    return self;
+}
+
+YCCPicture *raw_to_ycc(const uint8_t *frame, RawLayout layout, int width,
+    int height, int desired_height) {
+    if (desired_height > 0) {
+        return raw_resize(frame, layout, width, height, desired_height);
+    }
+
+    int chroma_width, chroma_height;
+    raw_chroma_size(layout, width, height, &chroma_width, &chroma_height);
+    const uint8_t *cb = frame + (size_t)width * height;
+    const uint8_t *cr = cb + (layout == RAW_NV12
+        ? 1
+        : (size_t)chroma_width * chroma_height);
+    int step = layout == RAW_NV12 ? 2 : 1;
+    int stride = chroma_width * step;
+
+    YCCPicture *self = ycc_new(width - width % 4, height - height % 2);
+    if (!self) {
+        return NULL;
+    }
+
+    for (int y = 0; y < self->height; y++) {
+        memcpy(self->luma + (size_t)y * self->width,
+            frame + (size_t)y * width, self->width);
+    }
+
+    int ycc_chroma_width = self->width / 4;
+    for (int cy = 0; cy < self->height / 2; cy++) {
+        uint8_t *out_cb = self->cb + (size_t)cy * ycc_chroma_width;
+        uint8_t *out_cr = self->cr + (size_t)cy * ycc_chroma_width;
+
+        if (layout == RAW_YUV4X2) {
+            memcpy(out_cb, cb + (size_t)cy * stride, ycc_chroma_width);
+            memcpy(out_cr, cr + (size_t)cy * stride, ycc_chroma_width);
+        } else {
+            raw_narrow_chroma(cb + (size_t)cy * stride, chroma_width, step,
+                out_cb, ycc_chroma_width);
+            raw_narrow_chroma(cr + (size_t)cy * stride, chroma_width, step,
+                out_cr, ycc_chroma_width);
+        }
+    }
+
+    return self;
+}
+
+bool raw_write_frame(const YCCPicture *picture, RawLayout layout,
+    FILE *file) {
+    int chroma_width = picture->width / 4;
+    int chroma_height = picture->height / 2;
+
+    fwrite(picture->luma, 1, (size_t)picture->width * picture->height, file);
+
+    if (layout == RAW_YUV4X2) {
+        size_t chroma_size = (size_t)chroma_width * chroma_height;
+        fwrite(picture->cb, 1, chroma_size, file);
+        fwrite(picture->cr, 1, chroma_size, file);
+        return !ferror(file);
+    }
+
+    // Either layout takes a full width row per chroma row
+    uint8_t *row = malloc(picture->width);
+    if (!row) {
+        u_error("[raw_write_frame] Failed to allocate chroma row!");
+        return false;
+    }
+
+    int row_width = picture->width / 2;
+    for (int cy = 0; cy < chroma_height; cy++) {
+        size_t offset = (size_t)cy * chroma_width;
+
+        if (layout == RAW_NV12) {
+            raw_widen_chroma(picture->cb + offset, chroma_width, row,
+                row_width, 2);
+            raw_widen_chroma(picture->cr + offset, chroma_width, row + 1,
+                row_width, 2);
+            fwrite(row, 1, 2 * row_width, file);
+        } else {
+            raw_widen_chroma(picture->cb + offset, chroma_width, row,
+                row_width, 1);
+            fwrite(row, 1, row_width, file);
+        }
+    }
+
+    // I420 keeps Cr in a plane of its own, after Cb
+    for (int cy = 0; layout == RAW_I420 && cy < chroma_height; cy++) {
+        raw_widen_chroma(picture->cr + (size_t)cy * chroma_width,
+            chroma_width, row, row_width, 1);
+        fwrite(row, 1, row_width, file);
+    }
+
+    free(row);
+    return !ferror(file);
+}
+
@@ -0,0 +1,37 @@
+#ifndef __RAW_H_
+#define __RAW_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "picture.h"
+
+/*
+ * Frames of raw planar YUV, studio swing as our pictures are. A frame
+ * is luma at full resolution followed by chroma:
+ *
+ *   RAW_I420    Cb and Cr planes, half width and half height
+ *   RAW_NV12    one plane of Cb Cr pairs, half width and half height
+ *   RAW_YUV4X2  Cb and Cr planes, quarter width and half height, laid
+ *               out and sited as YCCPicture keeps them
+ */
+typedef enum {
+    RAW_I420,
+    RAW_NV12,
+    RAW_YUV4X2
+} RawLayout;
+
+// Takes a layout by name, "yuv" being I420. Returns false if unknown.
+bool raw_parse_layout(const char *name, RawLayout *layout);
+size_t raw_frame_size(RawLayout layout, int width, int height);
+
+// Converts a frame to a picture cut to whole chroma blocks, or resized
+// to `desired_height` rows if it's positive.
+YCCPicture *raw_to_ycc(const uint8_t *frame, RawLayout layout, int width,
+    int height, int desired_height);
+
+// Writes a picture as a frame of its own size.
+bool raw_write_frame(const YCCPicture *picture, RawLayout layout,
+    FILE *file);
+
+#endif
+
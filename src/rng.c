@@ -0,0 +1,58 @@
+#include "rng.h"
+
+#define PHILOX_M0   0xD2511F53u
+#define PHILOX_M1   0xCD9E8D57u
+#define PHILOX_W0   0x9E3779B9u
+#define PHILOX_W1   0xBB67AE85u
+#define PHILOX_ROUNDS   10
+
+#define U32_TO_UNIT (1.0 / 4294967296.0)
+
+void rng_init(Rng *self, uint64_t seed, uint32_t frame, uint32_t pass,
+    uint32_t row) {
+    self->key[0] = (uint32_t)seed;
+    self->key[1] = (uint32_t)(seed >> 32);
+    self->ctr[0] = 0;
+    self->ctr[1] = row;
+    self->ctr[2] = pass;
+    self->ctr[3] = frame;
+}
+
+static void philox_block(const uint32_t ctr[4], const uint32_t key[2],
+    uint32_t out[4]) {
+    uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+    uint32_t k0 = key[0], k1 = key[1];
+
+    for (int i = 0; i < PHILOX_ROUNDS; i++) {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+        uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+
+        c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t)p1;
+        c3 = (uint32_t)p0;
+
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+void rng_fill(Rng *self, double *out, int count) {
+    uint32_t block[4];
+
+    // The unused tail of the last block is dropped
+    for (int i = 0; i < count; i += 4) {
+        philox_block(self->ctr, self->key, block);
+        self->ctr[0]++;
+
+        for (int j = 0; j < 4 && i + j < count; j++) {
+            out[i + j] = block[j] * U32_TO_UNIT;
+        }
+    }
+}
+
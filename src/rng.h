@@ -0,0 +1,21 @@
+#ifndef __RNG_H_
+#define __RNG_H_
+
+#include <stdint.h>
+
+/*
+ * Counter-based generator (Philox4x32-10). A stream is fully defined
+ * by its seed and coordinates, so any row can be generated on any
+ * thread in any order with the same result.
+ */
+typedef struct {
+    uint32_t key[2];
+    uint32_t ctr[4];
+} Rng;
+
+void rng_init(Rng *self, uint64_t seed, uint32_t frame, uint32_t pass,
+    uint32_t row);
+void rng_fill(Rng *self, double *out, int count);
+
+#endif
+
@@ -1,40 +1,106 @@
 
-#include <stdlib.h> /* rand */
+#include <stdlib.h> /* malloc */
 #include <time.h> /* time */
 #include <string.h> /* strcmp */
 #include <math.h> /* round */
-#include <stdio.h> /* sscanf */
+#include <stdio.h> /* sscanf, fprintf */
 #include <stdbool.h>
+#include <limits.h> /* INT_MAX */
 
 #include "secamizer.h"
+#include "batch.h"
+#include "video.h"
 #include "picture.h"
 #include "util.h"
 #include "noise.h"
+#include "tpool.h"
+#include "cpu.h"
+#include "rng.h"
 
 #define DEF_RNDM 0.001
 #define DEF_THRSHLD 0.024
+#define SHEET_SIDE_MAX 65535
 
-void secamizer_scan(Secamizer *self, YCCPicture *frame, int cx, int cy);
+typedef struct {
+    int point;
+    bool is_blue;
+} ScanState;
+
+typedef struct {
+    Secamizer *self;
+    YCCPicture *frame;
+    int stride; // of luma rows, chroma rows take a quarter of it
+    int frame_index;
+    int pass;
+} ScanJob;
+
+// Frames of an animation rendered side by side, to be written in order
+typedef struct {
+    Secamizer *self;
+    YCCPicture **frames;
+    int first;
+} AnimJob;
+
+// Frames rendered right into their tiles of a sheet, row by row
+typedef struct {
+    Secamizer *self;
+    YCCPicture *sheet;
+    int columns;
+} SheetJob;
+
+/* random numbers drawn per chroma sample, used or not */
+#define RND_PER_SAMPLE  6
+/* chroma samples drawn for at a time, keep RND_CHUNK * 6 a multiple of 4 */
+#define RND_CHUNK       64
+
+bool secamizer_open_input(Secamizer *self);
+void secamizer_render_frame(void *ctx, int index);
+void secamizer_render_anim_frame(void *ctx, int index);
+bool secamizer_render_animation(Secamizer *self, AnimFormat format);
+bool secamizer_render_sheet(Secamizer *self);
+void secamizer_render_tile(void *ctx, int index);
+void secamizer_scan_into(Secamizer *self, YCCPicture *frame, int stride,
+    int index);
+void secamizer_scan_row(void *ctx, int cy);
+void secamizer_scan(Secamizer *self, YCCPicture *frame, int stride,
+    ScanState *state, const double *rnd, int cx, int cy);
 
 void usage(const char *appname) {
     printf(
         "usage: %s [OPTIONS] <SOURCE or -I> <OUTPUT or -O>\n"
+        "       %s [OPTIONS] -B <DIRECTORY> <SOURCE>...\n"
         "\n"
         "Available options:\n"
         "\n"
         "    -r <VALUE>      set randomization factor, default is %g\n"
         "    -t <VALUE>      set threshold value, default is %g\n"
         "    -a <COUNT>      set count of frames\n"
+        "    -j <THREADS>    set count of worker threads, default is count of CPUs\n"
+        "                    available to the process, cgroup quota included\n"
+        "    -C <CPUS>       pin worker threads to CPUs, e.g. 0,2,4-7\n"
+        "    -s <SEED>       set random seed, default is current time\n"
+        "    -F              render frames in parallel, not only rows\n"
+        "    -T <COLUMNS>    put frames of -a into one sheet, COLUMNS wide\n"
+        "    -U              print thread pool utilisation when done, to\n"
+        "                    stderr\n"
         "    -f <FORMAT>     force output format (mandatory for stdout)\n"
-        "                    supported formats: jpg, png, bmp, tga\n"
+        "                    supported formats: jpg, png, bmp, tga,\n"
+        "                    avi, apng, gif (all -a frames in one file),\n"
+        "                    y4m, mjpeg, i420, nv12, yuv4x2 (raw YUV)\n"
         "    -q              be quiet, do not print anything\n"
         "    -R              force 480p\n"
         "    -I              read from stdin\n"
+        "    -i <FORMAT>     read a stream of frames: mjpeg, or raw YUV\n"
+        "                    i420, nv12, yuv4x2 (with -S)\n"
+        "    -S <WxH>        set size of raw YUV frames\n"
         "    -O              write to stdout\n"
+        "    -B <DIRECTORY>  secamize all sources into a directory\n"
         "    -? -h           show this help\n"
         "\n"
-        "A source can be in JPG or PNG formats. An output is same too.\n",
-        appname, DEF_RNDM, DEF_THRSHLD
+        "A source can be in JPG or PNG formats. An output is same too.\n"
+        "Streams of frames (Y4M, MJPEG, raw YUV) are secamized frame by\n"
+        "frame, into a stream of the same format unless -f says otherwise.\n",
+        appname, appname, DEF_RNDM, DEF_THRSHLD
     );
     exit(0);
 }
@@ -61,6 +127,12 @@ void parse_arguments(Secamizer *self, int argc, char **argv) {
             case 'R':
                 self->force_480 = true;
                 break;
+            case 'F':
+                self->parallel_frames = true;
+                break;
+            case 'U':
+                self->show_utilisation = true;
+                break;
             case 'I':
                 self->input_path = (const char *)0x57D;
                 break;
@@ -72,6 +144,13 @@ void parse_arguments(Secamizer *self, int argc, char **argv) {
             case 'a':
             case 'p':
             case 'f':
+            case 'j':
+            case 's':
+            case 'B':
+            case 'C':
+            case 'i':
+            case 'S':
+            case 'T':
                 catch_option = argv[i][1];
                 continue;
             case 'h':
@@ -98,27 +177,80 @@ void parse_arguments(Secamizer *self, int argc, char **argv) {
             case 'f':
                 self->forced_output_format = argv[i];
                 break;
+            case 'j':
+                sscanf(argv[i], "%d", &self->threads);
+                break;
+            case 's':
+                sscanf(argv[i], "%llu", &self->seed);
+                break;
+            case 'B':
+                self->batch_dir = argv[i];
+                break;
+            case 'C':
+                self->cpu_count = cpu_parse_list(argv[i], self->cpus,
+                    CPU_LIST_MAX);
+                if (self->cpu_count <= 0) {
+                    u_error("Bad CPU list \"%s\"!", argv[i]);
+                    usage(argv[0]);
+                }
+                break;
+            case 'i':
+                self->stream_format = argv[i];
+                break;
+            case 'S':
+                if (sscanf(argv[i], "%dx%d", &self->raw_width,
+                    &self->raw_height) != 2) {
+                    u_error("Bad frame size \"%s\"!", argv[i]);
+                    usage(argv[0]);
+                }
+                break;
+            case 'T':
+                if (sscanf(argv[i], "%d", &self->sheet_columns) != 1
+                    || self->sheet_columns < 1) {
+                    u_error("Bad column count \"%s\"!", argv[i]);
+                    usage(argv[0]);
+                }
+                break;
             }
             catch_option = 0;
             continue;
         } else {
-            // arguments without hyphen are treated as
-            // input and output paths respectively
-            if (!self->input_path) {
-                self->input_path = argv[i];
-            } else if (!self->output_path) {
-                self->output_path = argv[i];
-            } else {
-                u_error("Can't recognize argument \"%s\"", argv[i]);
-                usage(argv[0]);
-            }
+            self->batch_inputs[self->batch_count++] = argv[i];
         }
     }
+
+    // A sheet is one picture made of the frames of one picture
+    if (self->sheet_columns > 0 && (self->batch_dir || self->stream_format)) {
+        u_error("-T can't be used with %s.", self->batch_dir ? "-B" : "-i");
+        usage(argv[0]);
+    }
+
+    if (self->batch_dir) {
+        return;
+    }
+
+    // otherwise arguments without hyphen are treated as
+    // input and output paths respectively
+    for (int i = 0; i < self->batch_count; i++) {
+        if (!self->input_path) {
+            self->input_path = self->batch_inputs[i];
+        } else if (!self->output_path) {
+            self->output_path = self->batch_inputs[i];
+        } else {
+            u_error("Can't recognize argument \"%s\"", self->batch_inputs[i]);
+            usage(argv[0]);
+        }
+    }
+
+    AnimFormat format;
+    if (self->sheet_columns > 0 && self->output_path
+        && secamizer_anim_format(self, self->output_path, &format)) {
+        u_error("-T can't be used with an animation output.");
+        usage(argv[0]);
+    }
 }
 
 Secamizer *secamizer_init(int argc, char **argv) {
-    srand(time(NULL));
-
     Secamizer *self = malloc(sizeof(Secamizer));
     if (!self) {
         u_error("Failed to allocate Secamizer!");
@@ -130,109 +262,466 @@ Secamizer *secamizer_init(int argc, char **argv) {
     self->frames = 1;
     self->pass_count = 1;
     self->force_480 = false;
+    self->parallel_frames = false;
+    self->show_utilisation = false;
     self->forced_output_format = NULL;
+    self->threads = 0;
+    self->cpu_count = 0;
+    self->stream_format = NULL;
+    self->raw_width = 0;
+    self->raw_height = 0;
+    self->sheet_columns = 0;
+    self->seed = time(NULL);
 
     self->input_path = NULL;
     self->output_path = NULL;
+    self->source = NULL;
+    self->video = NULL;
+
+    self->batch_dir = NULL;
+    self->batch_count = 0;
+    self->batch_inputs = malloc(sizeof(const char *) * argc);
+    self->cpus = malloc(sizeof(int) * CPU_LIST_MAX);
+    if (!self->batch_inputs || !self->cpus) {
+        u_error("Failed to allocate input list!");
+        free(self->batch_inputs);
+        free(self->cpus);
+        free(self);
+        return NULL;
+    }
 
     parse_arguments(self, argc, argv);
+    srand(self->seed);
 
-    if (!self->input_path || !self->output_path) {
+    if (self->batch_dir ? self->batch_count == 0
+        : !self->input_path || !self->output_path) {
         secamizer_destroy(&self);
         usage(argv[0]);
     }
 
-    self->source = ycc_load_picture(self->input_path,
-        self->force_480 ? 480 : -1);
-    if (!self->source) {
-        u_error("Can't open picture %s.", self->input_path);
+    // Without -j, as many threads as there are CPUs to pin to or to use
+    if (self->threads <= 0) {
+        self->threads = self->cpu_count > 0 ? self->cpu_count : cpu_budget();
+    }
+
+    if (!tpool_init(self->threads, self->cpus, self->cpu_count)) {
+        return NULL;
+    }
+
+    if (self->batch_dir) {
+        return self;
+    }
+
+    if (!secamizer_open_input(self)) {
+        u_error("Can't open picture %s.",
+            self->input_path == (const char *)0x57D
+                ? "from stdin"
+                : self->input_path);
+        return NULL;
+    }
+
+    if (self->video && self->sheet_columns > 0) {
+        u_error("-T can't be used with a stream of frames.");
+        secamizer_destroy(&self);
         return NULL;
     }
 
     return self;
 }
 
-void secamizer_run(Secamizer *self) {
-    int width = self->source->width;
-    int height = self->source->height;
-    
-    for (int i = 0; i < self->frames; i++) {
-        YCCPicture *frame = ycc_new(width, height);
-        ycc_copy(frame, self->source);
-
-        for (int pass = 0; pass < self->pass_count; pass++) {
-            for (int cy = 0; cy < height / 2; cy++) {
-                for (int cx = 0; cx < width / 4; cx++) {
-                    secamizer_scan(self, frame, cx, cy);
-                }
+// Opens a stream of frames as `self->video`, or loads a picture as
+// `self->source`. MJPEG and raw YUV are asked for with -i, a Y4M stream
+// on stdin is told by its first bytes, a Y4M file by extension.
+bool secamizer_open_input(Secamizer *self) {
+    int desired_height = self->force_480 ? 480 : -1;
+    bool from_stdin = self->input_path == (const char *)0x57D;
+    const char *ext = from_stdin ? NULL : u_get_file_ext(self->input_path);
+
+    bool y4m_file = ext && strcmp(ext, "y4m") == 0;
+
+    if (!self->stream_format && !from_stdin && !y4m_file) {
+        self->source = ycc_load_picture(self->input_path, desired_height);
+        return self->source != NULL;
+    }
+
+    FILE *file = from_stdin ? stdin : fopen(self->input_path, "rb");
+    if (!file) {
+        u_error("File \"%s\" doesn't exist.", self->input_path);
+        return false;
+    }
+
+    if (self->stream_format) {
+        StreamFormat format;
+        RawLayout layout = RAW_I420;
+        if (!stream_parse_format(self->stream_format, &format, &layout)
+            || format == STREAM_Y4M) {
+            u_error("Unknown stream format %s!", self->stream_format);
+        } else if (format == STREAM_RAW
+            && (self->raw_width <= 0 || self->raw_height <= 0)) {
+            u_error("Size of raw YUV frames is needed, see -S.");
+        } else {
+            self->video = stream_reader_new(file, format, layout,
+                self->raw_width, self->raw_height);
+            return self->video != NULL;
+        }
+
+        if (file != stdin) {
+            fclose(file);
+        }
+        return false;
+    }
+
+    uint8_t head[sizeof(Y4M_SIGNATURE) - 1];
+    size_t head_length = fread(head, 1, sizeof(head), file);
+    if (head_length == sizeof(head)
+        && memcmp(head, Y4M_SIGNATURE, sizeof(head)) == 0) {
+        self->video = stream_reader_new(file, STREAM_Y4M, RAW_I420, 0, 0);
+        return self->video != NULL;
+    }
+
+    size_t length;
+    uint8_t *data = u_read_file(file, head, head_length, &length);
+    if (file != stdin) {
+        fclose(file);
+    }
+    if (!data) {
+        return false;
+    }
+
+    self->source = ycc_decode_picture(data, length, desired_height);
+    free(data);
+    return self->source != NULL;
+}
+
+bool secamizer_run(Secamizer *self) {
+    bool ok = true;
+    AnimFormat format;
+
+    if (self->batch_dir) {
+        ok = batch_run(self);
+    } else if (self->video) {
+        ok = video_run(self);
+    } else if (self->sheet_columns > 0) {
+        ok = secamizer_render_sheet(self);
+    } else if (secamizer_anim_format(self, self->output_path, &format)) {
+        ok = secamizer_render_animation(self, format);
+    } else if (self->parallel_frames) {
+        // Frames become tasks of their own, their rows are nested in them
+        tpool_for(self->frames, secamizer_render_frame, self);
+    } else {
+        for (int i = 0; i < self->frames; i++) {
+            secamizer_render_frame(self, i);
+        }
+    }
+
+    // Not with u_message: stdout may be the output, or closed by now
+    if (self->show_utilisation && !u_quiet) {
+        fprintf(stderr, "Thread pool utilisation: %.1f%%\n",
+            tpool_utilisation() * 100.0);
+    }
+
+    return ok;
+}
+
+void secamizer_render_frame(void *ctx, int index) {
+    Secamizer *self = ctx;
+
+    YCCPicture *frame = secamizer_scan_frame(self, self->source, index);
+    if (!frame) {
+        return;
+    }
+
+    char name[1024];
+    ycc_save_picture(frame,
+        secamizer_output_name(self, name, self->output_path, index),
+        self->forced_output_format);
+
+    ycc_delete(&frame);
+}
+
+// All frames go into one file, a window of them rendered at a time:
+// one frame with its rows in parallel, or with -F a frame per thread.
+bool secamizer_render_animation(Secamizer *self, AnimFormat format) {
+    if (self->output_path == (const char *)0x57D) {
+        u_error("Animations can only be written to files.");
+        return false;
+    }
+
+    int window = self->parallel_frames ? tpool_threads() : 1;
+    YCCPicture **frames = calloc(window, sizeof(YCCPicture *));
+    AnimWriter *anim = frames
+        ? anim_writer_new(self->output_path, format, self->source->width,
+            self->source->height, self->frames)
+        : NULL;
+    if (!anim) {
+        free(frames);
+        return false;
+    }
+
+    bool ok = true;
+    AnimJob job = { self, frames, 0 };
+    for (; job.first < self->frames; job.first += window) {
+        int count = self->frames - job.first;
+        if (count > window) {
+            count = window;
+        }
+
+        tpool_for(count, secamizer_render_anim_frame, &job);
+
+        for (int i = 0; i < count; i++) {
+            ok = frames[i] && anim_write_frame(anim, frames[i]) && ok;
+            if (frames[i]) {
+                ycc_delete(&frames[i]);
             }
         }
+    }
 
-        if (self->frames > 1) {
-            char output_base_name[256];
-            char output_full_name[1024];
-            const char *ext = u_get_file_ext(self->output_path);
+    ok = anim_writer_close(&anim) && ok;
+    free(frames);
 
-            u_get_file_base(output_base_name, self->output_path);
-            sprintf(output_full_name, "%s-%d.%s", output_base_name, i, ext);
-            ycc_save_picture(frame, output_full_name, self->forced_output_format);
-        } else {
-            ycc_save_picture(frame, self->output_path, self->forced_output_format);
+    if (!ok) {
+        u_error("Failed to save %s.", self->output_path);
+    }
+    return ok;
+}
+
+void secamizer_render_anim_frame(void *ctx, int index) {
+    AnimJob *job = ctx;
+
+    job->frames[index] = secamizer_scan_frame(job->self, job->self->source,
+        job->first + index);
+}
+
+// All frames go into one picture, a grid of tiles the size of the
+// source, which is encoded once. Each frame is scanned right in its tile.
+bool secamizer_render_sheet(Secamizer *self) {
+    const YCCPicture *source = self->source;
+    if (self->frames < 1) {
+        u_error("A sheet needs at least one frame.");
+        return false;
+    }
+
+    int columns = self->sheet_columns < self->frames
+        ? self->sheet_columns
+        : self->frames;
+    int rows = (self->frames + columns - 1) / columns;
+
+    // JPEG and TGA can't go beyond 65535 a side, and RGBA of the sheet,
+    // as PNG encodes it, must still be indexed by an int
+    size_t width = (size_t)source->width * columns;
+    size_t height = (size_t)source->height * rows;
+    if (width > SHEET_SIDE_MAX || height > SHEET_SIDE_MAX
+        || width * height > INT_MAX / 4) {
+        u_error("A sheet of %dx%d frames would be %zux%zu, too big.",
+            columns, rows, width, height);
+        return false;
+    }
+
+    YCCPicture *sheet = ycc_new(width, height);
+    if (!sheet) {
+        u_error("Failed to allocate a sheet of %dx%d frames.", columns, rows);
+        return false;
+    }
+
+    SheetJob job = { self, sheet, columns };
+    if (self->parallel_frames) {
+        tpool_for(self->frames, secamizer_render_tile, &job);
+    } else {
+        for (int i = 0; i < self->frames; i++) {
+            secamizer_render_tile(&job, i);
+        }
+    }
+
+    // Tiles past the last frame are left black
+    int chroma_width = source->width / 4;
+    for (int i = self->frames; i < columns * rows; i++) {
+        int x = (i % columns) * source->width;
+        int y = (i / columns) * source->height;
+
+        for (int row = 0; row < source->height; row++) {
+            memset(sheet->luma + (size_t)(y + row) * sheet->width + x, 16,
+                source->width);
+        }
+        for (int row = 0; row < source->height / 2; row++) {
+            size_t at = (size_t)(y / 2 + row) * (sheet->width / 4) + x / 4;
+            memset(sheet->cb + at, 128, chroma_width);
+            memset(sheet->cr + at, 128, chroma_width);
         }
-        
-        ycc_delete(&frame);
+    }
+
+    bool ok = ycc_save_picture(sheet, self->output_path,
+        self->forced_output_format);
+    ycc_delete(&sheet);
+
+    if (!ok) {
+        u_error("Failed to save %s.", self->output_path);
+    }
+    return ok;
+}
+
+// Copies the source into the tile of frame `index` and scans it there.
+void secamizer_render_tile(void *ctx, int index) {
+    SheetJob *job = ctx;
+    const YCCPicture *source = job->self->source;
+    YCCPicture *sheet = job->sheet;
+    int x = (index % job->columns) * source->width;
+    int y = (index / job->columns) * source->height;
+    int chroma_width = source->width / 4;
+
+    // A view of the tile, with rows as far apart as the sheet's
+    YCCPicture tile = {
+        .luma = sheet->luma + (size_t)y * sheet->width + x,
+        .cb = sheet->cb + (size_t)(y / 2) * (sheet->width / 4) + x / 4,
+        .cr = sheet->cr + (size_t)(y / 2) * (sheet->width / 4) + x / 4,
+        .width = source->width,
+        .height = source->height
+    };
+
+    for (int row = 0; row < source->height; row++) {
+        memcpy(tile.luma + (size_t)row * sheet->width,
+            source->luma + (size_t)row * source->width, source->width);
+    }
+    for (int row = 0; row < source->height / 2; row++) {
+        size_t at = (size_t)row * (sheet->width / 4);
+        memcpy(tile.cb + at, source->cb + row * chroma_width, chroma_width);
+        memcpy(tile.cr + at, source->cr + row * chroma_width, chroma_width);
+    }
+
+    secamizer_scan_into(job->self, &tile, sheet->width, index);
+}
+
+YCCPicture *secamizer_scan_frame(Secamizer *self, const YCCPicture *source,
+    int index) {
+    // Scanning only touches chroma, so frames share the source's luma
+    YCCPicture *frame = ycc_share(source);
+    if (!frame) {
+        return NULL;
+    }
+
+    secamizer_scan_into(self, frame, frame->width, index);
+
+    return frame;
+}
+
+// Scans `frame` in place, its rows being `stride` bytes apart, as they
+// are when it is a tile of a bigger picture.
+void secamizer_scan_into(Secamizer *self, YCCPicture *frame, int stride,
+    int index) {
+    ScanJob job = { self, frame, stride, index, 0 };
+    for (job.pass = 0; job.pass < self->pass_count; job.pass++) {
+        tpool_for(frame->height / 2, secamizer_scan_row, &job);
     }
 }
 
+// Frames of an animation go to "<base>-<index>.<ext>", built in `name`
+// which must have room for 1024 characters. A single frame keeps `path`.
+const char *secamizer_output_name(Secamizer *self, char *name,
+    const char *path, int index) {
+    if (self->frames <= 1) {
+        return path;
+    }
+
+    char output_base_name[256];
+    const char *ext = u_get_file_ext(path);
+
+    u_get_file_base(output_base_name, path);
+    sprintf(name, "%s-%d.%s", output_base_name, index, ext);
+
+    return name;
+}
+
+// Tells if frames are to be written to `path` as one animation, taking
+// the forced output format over the extension.
+bool secamizer_anim_format(Secamizer *self, const char *path,
+    AnimFormat *format) {
+    const char *ext = self->forced_output_format;
+    if (!ext && path != (const char *)0x57D) {
+        ext = u_get_file_ext(path);
+    }
+
+    return anim_parse_format(ext, format);
+}
+
 void secamizer_destroy(Secamizer **selfp) {
     Secamizer *self = *selfp;
     if (self->source) {
         ycc_delete(&self->source);
     }
+    if (self->video) {
+        stream_reader_delete(&self->video);
+    }
+    free(self->batch_inputs);
+    free(self->cpus);
+    ycc_release_pools();
+    tpool_shutdown();
     *selfp = NULL;
 }
 
 #define MIN_HS  12  /* minimal horizontal step */
 
-void secamizer_scan(Secamizer *self, YCCPicture *frame, int cx, int cy) {
-    static int point;
-    static bool is_blue;
+void secamizer_scan_row(void *ctx, int cy) {
+    ScanJob *job = ctx;
+    ScanState state = { -1, false };
+    int chroma_width = job->frame->width / 4;
+    Rng rng;
+
+    // Random numbers come a chunk of samples at a time. The generator
+    // hands them out in fours, so chunks of whole fours continue the
+    // same stream as one long fill would.
+    double rnd[RND_CHUNK * RND_PER_SAMPLE];
+
+    rng_init(&rng, job->self->seed, job->frame_index, job->pass, cy);
+
+    for (int first = 0; first < chroma_width; first += RND_CHUNK) {
+        int count = chroma_width - first < RND_CHUNK
+            ? chroma_width - first
+            : RND_CHUNK;
+        rng_fill(&rng, rnd, count * RND_PER_SAMPLE);
+
+        for (int i = 0; i < count; i++) {
+            secamizer_scan(job->self, job->frame, job->stride, &state,
+                rnd + i * RND_PER_SAMPLE, first + i, cy);
+        }
+    }
+}
 
+void secamizer_scan(Secamizer *self, YCCPicture *frame, int stride,
+    ScanState *state, const double *rnd, int cx, int cy) {
     if (cx == 0) {
-        point = -1;
+        state->point = -1;
         return;
     }
     
-    uint8_t *luma = frame->luma + ((cy * 2) * frame->width + (cx * 4));
+    uint8_t *luma = frame->luma + ((cy * 2) * stride + (cx * 4));
 
     double a = ((double)luma[0] + (double)luma[1]) / 2.0;
     double b = ((double)luma[2] + (double)luma[3]) / 2.0;
     double delta = (a - b) / 256.0;
-    int gain = point == -1 ? MIN_HS * 1.5 : cx - point;
-    int hs = MIN_HS + FRAND() * (MIN_HS * 10.5);
+    int gain = state->point == -1 ? MIN_HS * 1.5 : cx - state->point;
+    int hs = MIN_HS + rnd[0] * (MIN_HS * 10.5);
     
     double ethrshld = self->thrshld +
-        (FRAND() * self->thrshld - self->thrshld * 0.5);
+        (rnd[1] * self->thrshld - self->thrshld * 0.5);
     
-    if ((delta * FRAND() + self->rndm * FRAND() > ethrshld) && (gain > hs)) {
-        point = cx;
-        is_blue = (FRAND() <= 0.25); /* Cb с вер. 0.25 */
+    if ((delta * rnd[2] + self->rndm * rnd[3] > ethrshld) && (gain > hs)) {
+        state->point = cx;
+        state->is_blue = (rnd[4] <= 0.25); /* Cb с вер. 0.25 */
     }
     
-    if (point < 0) {
+    if (state->point < 0) {
         return;
     }
     
-    double fire = (320.0 + FRAND() * 128.0) / (gain + 1.0) - 1.0;
+    double fire = (320.0 + rnd[5] * 128.0) / (gain + 1.0) - 1.0;
     if (fire < 0) {
         /* fire is faded */
-        point = -1;
+        state->point = -1;
         return;
     }
 
-    int chroma_idx = cy * (frame->width / 4) + cx;
+    int chroma_idx = cy * (stride / 4) + cx;
 
-    if (is_blue) {
+    if (state->is_blue) {
         frame->cb[chroma_idx] = COLOR_CLAMP(frame->cb[chroma_idx] + fire);
     } else {
         frame->cr[chroma_idx] = COLOR_CLAMP(frame->cr[chroma_idx] + fire);
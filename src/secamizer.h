@@ -4,21 +4,43 @@
 
 #include <stdbool.h>
 #include "picture.h"
+#include "stream.h"
+#include "anim.h"
 
 typedef struct {
     YCCPicture *source;
+    StreamReader *video; // instead of `source` for a stream of frames
     const char *input_path;
     const char *output_path;
     const char *forced_output_format;
+    const char *batch_dir;
+    const char **batch_inputs;
+    int batch_count;
     double rndm;
     double thrshld;
     int frames;
     int pass_count;
+    int threads;
+    int *cpus;
+    int cpu_count;
+    const char *stream_format; // input is a stream of these, if given
+    int raw_width;
+    int raw_height;
+    int sheet_columns; // frames go into one picture, if given
+    unsigned long long seed;
     bool force_480;
+    bool parallel_frames;
+    bool show_utilisation;
 } Secamizer;
 
 Secamizer *secamizer_init(int argc, char **argv);
-void secamizer_run(Secamizer *self);
+bool secamizer_run(Secamizer *self);
+YCCPicture *secamizer_scan_frame(Secamizer *self, const YCCPicture *source,
+    int index);
+const char *secamizer_output_name(Secamizer *self, char *name,
+    const char *path, int index);
+bool secamizer_anim_format(Secamizer *self, const char *path,
+    AnimFormat *format);
 void secamizer_destroy(Secamizer **selfp);
 
 #endif
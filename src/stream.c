@@ -0,0 +1,293 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "stream.h"
+#include "jpeg.h"
+#include "util.h"
+
+#define JPEG_QUALITY        0
+#define MJPEG_FRAME_SIZE    (1 << 20) /* room for a JPEG frame at first */
+
+// JPEG markers that stand alone, without a length
+#define MARKER_SOI      0xD8
+#define MARKER_EOI      0xD9
+#define MARKER_SOS      0xDA
+#define IS_RST(m)       ((m) >= 0xD0 && (m) <= 0xD7)
+
+bool stream_parse_format(const char *name, StreamFormat *format,
+    RawLayout *layout) {
+    if (strcmp(name, "y4m") == 0) {
+        *format = STREAM_Y4M;
+    } else if (strcmp(name, "mjpeg") == 0 || strcmp(name, "mjpg") == 0) {
+        *format = STREAM_MJPEG;
+    } else if (raw_parse_layout(name, layout)) {
+        *format = STREAM_RAW;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+StreamReader *stream_reader_new(FILE *file, StreamFormat format,
+    RawLayout layout, int width, int height) {
+    StreamReader *self = calloc(1, sizeof(StreamReader));
+    if (!self) {
+        u_error("[stream_reader_new] Failed to allocate StreamReader "
+            "structure.");
+        return NULL;
+    }
+
+    self->file = file;
+    self->format = format;
+    self->layout = format == STREAM_Y4M ? RAW_I420 : layout;
+    self->width = width;
+    self->height = height;
+
+    if (format == STREAM_MJPEG) {
+        // Frames find their own size, the buffer grows to the largest
+        self->frame_size = MJPEG_FRAME_SIZE;
+    } else {
+        if (format == STREAM_Y4M && !y4m_read_header(file, &self->width,
+            &self->height, self->tags)) {
+            stream_reader_delete(&self);
+            return NULL;
+        }
+
+        if (self->width < 4 || self->height < 2) {
+            u_error("[stream_reader_new] Bad frame size %dx%d.",
+                self->width, self->height);
+            stream_reader_delete(&self);
+            return NULL;
+        }
+
+        self->frame_size = raw_frame_size(self->layout, self->width,
+            self->height);
+    }
+
+    self->frame = malloc(self->frame_size);
+    if (!self->frame) {
+        u_error("[stream_reader_new] Failed to allocate frame buffer!");
+        stream_reader_delete(&self);
+        return NULL;
+    }
+
+    return self;
+}
+
+// Appends to the frame, growing the buffer. Failing to marks the
+// stream as failed, and the frame is dropped at its end.
+static void stream_put_byte(StreamReader *self, int c) {
+    if (self->failed) {
+        return;
+    }
+
+    if (self->frame_length == self->frame_size) {
+        uint8_t *grown = realloc(self->frame, self->frame_size * 2);
+        if (!grown) {
+            u_error("[stream_put_byte] Failed to grow frame buffer!");
+            self->failed = true;
+            return;
+        }
+        self->frame = grown;
+        self->frame_size *= 2;
+    }
+
+    self->frame[self->frame_length++] = c;
+}
+
+/*
+ * Reads one JPEG frame, from SOI to EOI, following the markers: lengths
+ * of segments are skipped over, so that a thumbnail in an APP segment
+ * doesn't end the frame, and entropy-coded data runs up to the next
+ * marker that isn't a restart. Anything between frames is dropped.
+ */
+static bool stream_read_jpeg(StreamReader *self) {
+    FILE *file = self->file;
+    int c, marker;
+
+    self->frame_length = 0;
+
+    // Looking for SOI
+    int previous = EOF;
+    while ((c = getc_unlocked(file)) != EOF) {
+        if (previous == 0xFF && c == MARKER_SOI) {
+            break;
+        }
+        previous = c;
+    }
+    if (c == EOF) {
+        return false;
+    }
+
+    stream_put_byte(self, 0xFF);
+    stream_put_byte(self, MARKER_SOI);
+
+    marker = EOF;
+    for (;;) {
+        if (marker == EOF) {
+            // Fill bytes may come before a marker
+            while ((c = getc_unlocked(file)) == 0xFF) {
+            }
+            if (c == EOF) {
+                break;
+            }
+            marker = c;
+        }
+
+        stream_put_byte(self, 0xFF);
+        stream_put_byte(self, marker);
+        if (marker == MARKER_EOI) {
+            return !self->failed;
+        }
+
+        int current = marker;
+        marker = EOF;
+        if (IS_RST(current)) {
+            continue;
+        }
+
+        int hi = getc_unlocked(file);
+        int lo = getc_unlocked(file);
+        if (lo == EOF) {
+            break;
+        }
+        int length = (hi << 8 | lo) - 2;
+        stream_put_byte(self, hi);
+        stream_put_byte(self, lo);
+
+        for (int i = 0; i < length && (c = getc_unlocked(file)) != EOF; i++) {
+            stream_put_byte(self, c);
+        }
+
+        if (current != MARKER_SOS) {
+            continue;
+        }
+
+        // Scan data, in which 0xFF is followed by 0 or by a restart
+        while ((c = getc_unlocked(file)) != EOF) {
+            if (c != 0xFF) {
+                stream_put_byte(self, c);
+                continue;
+            }
+
+            while ((c = getc_unlocked(file)) == 0xFF) {
+            }
+            if (c == 0 || IS_RST(c)) {
+                stream_put_byte(self, 0xFF);
+                stream_put_byte(self, c);
+            } else {
+                marker = c;
+                break;
+            }
+        }
+    }
+
+    u_error("[stream_read_jpeg] Stream ends in the middle of a frame.");
+    self->failed = true;
+    return false;
+}
+
+YCCPicture *stream_read_frame(StreamReader *self, int desired_height) {
+    if (self->format == STREAM_MJPEG) {
+        if (!stream_read_jpeg(self)) {
+            return NULL;
+        }
+
+        bool failed;
+        YCCPicture *picture = jpeg_read(self->frame, self->frame_length,
+            desired_height, &failed, &self->jpeg);
+        if (!picture && !failed) {
+            picture = ycc_decode_picture(self->frame, self->frame_length,
+                desired_height);
+        }
+        if (!picture) {
+            u_error("[stream_read_frame] Failed to decode a JPEG frame.");
+            self->failed = true;
+        }
+        return picture;
+    }
+
+    if (self->format == STREAM_Y4M
+        && !y4m_read_frame_header(self->file, &self->failed)) {
+        return NULL;
+    }
+
+    size_t length = fread(self->frame, 1, self->frame_size, self->file);
+    if (length != self->frame_size) {
+        // Raw streams simply end between frames
+        if (self->format == STREAM_Y4M || length > 0 || ferror(self->file)) {
+            u_error("[stream_read_frame] Stream ends in the middle of a "
+                "frame.");
+            self->failed = true;
+        }
+        return NULL;
+    }
+
+    YCCPicture *picture = raw_to_ycc(self->frame, self->layout, self->width,
+        self->height, desired_height);
+    self->failed = !picture;
+
+    return picture;
+}
+
+void stream_reader_delete(StreamReader **selfp) {
+    StreamReader *self = *selfp;
+
+    if (self->file && self->file != stdin) {
+        fclose(self->file);
+    }
+    free(self->frame);
+    jpeg_buffers_free(&self->jpeg);
+    free(self);
+
+    *selfp = NULL;
+}
+
+static void stream_fwrite(void *file, void *data, int size) {
+    fwrite(data, 1, size, (FILE *)file);
+}
+
+bool stream_write_frame(StreamWriter *self, const YCCPicture *picture) {
+    bool rc;
+
+    if (!self->started) {
+        self->width = picture->width;
+        self->height = picture->height;
+    } else if (self->format != STREAM_MJPEG && (picture->width != self->width
+        || picture->height != self->height)) {
+        u_error("[stream_write_frame] Frame is %dx%d, the stream is %dx%d.",
+            picture->width, picture->height, self->width, self->height);
+        return false;
+    }
+
+    switch (self->format) {
+    case STREAM_MJPEG:
+        rc = jpeg_write(picture, stream_fwrite, self->file, JPEG_QUALITY,
+            &self->jpeg) && !ferror(self->file);
+        break;
+    case STREAM_Y4M:
+        if (!self->started) {
+            y4m_write_header(self->file, picture->width, picture->height,
+                self->tags);
+        }
+        y4m_write_frame_header(self->file);
+        rc = raw_write_frame(picture, RAW_I420, self->file);
+        break;
+    default:
+        rc = raw_write_frame(picture, self->layout, self->file);
+        break;
+    }
+
+    if (!rc) {
+        u_error("[stream_write_frame] Failed to write frame.");
+    }
+
+    self->started = true;
+    return rc;
+}
+
+void stream_writer_free(StreamWriter *self) {
+    jpeg_buffers_free(&self->jpeg);
+}
+
@@ -0,0 +1,74 @@
+#ifndef __STREAM_H_
+#define __STREAM_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "picture.h"
+#include "jpeg.h"
+#include "raw.h"
+#include "y4m.h"
+
+/*
+ * Streams of frames: Y4M, raw YUV frames back to back, or JPEG frames
+ * back to back (MJPEG). Frames are read and written one at a time, and
+ * buffers are kept from one frame to the next.
+ */
+typedef enum {
+    STREAM_Y4M,
+    STREAM_RAW,
+    STREAM_MJPEG
+} StreamFormat;
+
+typedef struct {
+    FILE            *file;
+    StreamFormat    format;
+    RawLayout       layout; // of raw and Y4M frames
+    int             width; // of raw and Y4M frames
+    int             height;
+    char            tags[Y4M_TAGS_SIZE]; // of a Y4M stream, passed on
+    uint8_t         *frame; // one frame as it comes
+    size_t          frame_size; // room in `frame`
+    size_t          frame_length; // of the frame in it
+    bool            failed; // the stream didn't end where it should have
+    JpegBuffers     jpeg; // decoder of MJPEG frames
+} StreamReader;
+
+typedef struct {
+    FILE            *file;
+    StreamFormat    format;
+    RawLayout       layout;
+    const char      *tags; // NULL or the tags of a Y4M reader
+    bool            started; // first frame is out
+    int             width; // of the first frame
+    int             height;
+    JpegBuffers     jpeg; // encoder of MJPEG frames
+} StreamWriter;
+
+// Takes a stream format by name, a raw YUV layout going into `layout`.
+// Returns false if unknown.
+bool stream_parse_format(const char *name, StreamFormat *format,
+    RawLayout *layout);
+
+// Reads the header of a Y4M stream, the signature of which has been
+// read off already, or takes raw frames of `layout` and the given size,
+// or JPEG frames. The reader closes `file` when deleted, unless it is
+// stdin.
+StreamReader *stream_reader_new(FILE *file, StreamFormat format,
+    RawLayout layout, int width, int height);
+
+// Returns the next frame, resized to `desired_height` rows if it's
+// positive, or NULL at the end of the stream or on error, which sets
+// `failed`.
+YCCPicture *stream_read_frame(StreamReader *self, int desired_height);
+void stream_reader_delete(StreamReader **selfp);
+
+// A Y4M stream starts with a header for the size of its first frame.
+// Y4M and raw frames after it must come at the same size.
+bool stream_write_frame(StreamWriter *self, const YCCPicture *picture);
+
+// Frees what the writer keeps from one frame to the next. The file is
+// left to whoever opened it.
+void stream_writer_free(StreamWriter *self);
+
+#endif
+
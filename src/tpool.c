@@ -0,0 +1,371 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "tpool.h"
+#include "util.h"
+
+/*
+ * A work-stealing pool. Every worker owns a deque of index ranges: it
+ * pops the most recently split range from the bottom while idle workers
+ * steal the oldest, biggest ones from the top. Threads outside the pool
+ * share one extra deque. tpool_for may be called from any thread, also
+ * from inside a task; the caller runs tasks too while it waits, so
+ * `threads` counts it and a pool of one thread spawns nothing.
+ */
+
+#define DEQUE_SIZE  256 /* ranges a deque holds before splitting stops */
+#define SPLITS      4   /* ranges per thread a loop is split into at least */
+
+typedef struct {
+    TaskFunc    fn;
+    void        *ctx;
+    int         grain;
+    atomic_int  pending; // indices not done yet
+} Job;
+
+typedef struct {
+    Job *job;
+    int begin;
+    int end;
+} Task;
+
+typedef struct {
+    pthread_mutex_t lock;
+    Task            tasks[DEQUE_SIZE];
+    unsigned        top; // thieves take from here
+    unsigned        bottom; // the owner pushes and pops here
+} Deque;
+
+static pthread_t *workers = NULL;
+static int worker_count = 0;
+
+// CPUs threads get pinned to, round robin, if any
+static int *pinned_cpus = NULL;
+static int pinned_count = 0;
+static cpu_set_t unpinned_set; // CPUs of the process before pinning
+
+// deques[0] is shared by threads from outside the pool
+static Deque *deques = NULL;
+static int deque_count = 0;
+static atomic_llong *busy_ns = NULL;
+static struct timespec started;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static atomic_uint epoch = 0;
+static atomic_int sleepers = 0;
+static atomic_bool stopping = false;
+
+static _Thread_local int own = 0; // index of this thread's deque
+static _Thread_local int depth = 0; // tasks running on this thread's stack
+static _Thread_local unsigned victim_seed = 0;
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static bool deque_push(Deque *deque, Task task) {
+    bool pushed = false;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom - deque->top < DEQUE_SIZE) {
+        deque->tasks[deque->bottom++ % DEQUE_SIZE] = task;
+        pushed = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return pushed;
+}
+
+static bool deque_pop(Deque *deque, Task *task) {
+    bool popped = false;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom != deque->top) {
+        *task = deque->tasks[--deque->bottom % DEQUE_SIZE];
+        popped = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return popped;
+}
+
+static bool deque_steal(Deque *deque, Task *task) {
+    bool stolen = false;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom != deque->top) {
+        *task = deque->tasks[deque->top++ % DEQUE_SIZE];
+        stolen = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return stolen;
+}
+
+// Tells sleeping threads that there is new work or a finished loop.
+static void notify(void) {
+    atomic_fetch_add(&epoch, 1);
+    if (atomic_load(&sleepers) > 0) {
+        pthread_mutex_lock(&lock);
+        pthread_cond_broadcast(&wake);
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+// Sleeps until notify is called after `seen` was read from `epoch`.
+static void idle_wait(unsigned seen) {
+    atomic_fetch_add(&sleepers, 1);
+    pthread_mutex_lock(&lock);
+    while (atomic_load(&epoch) == seen && !atomic_load(&stopping)) {
+        pthread_cond_wait(&wake, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+    atomic_fetch_sub(&sleepers, 1);
+}
+
+static bool take_task(Task *task) {
+    if (deque_pop(&deques[own], task)) {
+        return true;
+    }
+
+    // Start from a random victim, so that thieves spread out
+    victim_seed = victim_seed * 1103515245 + 12345;
+    int first = (victim_seed >> 16) % deque_count;
+
+    for (int i = 0; i < deque_count; i++) {
+        int victim = (first + i) % deque_count;
+        if (victim != own && deque_steal(&deques[victim], task)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void run_task(Task task) {
+    Job *job = task.job;
+
+    // Split off halves for others to steal until the range is small
+    while (task.end - task.begin > job->grain) {
+        int middle = task.begin + (task.end - task.begin) / 2;
+        Task rest = { job, middle, task.end };
+        if (!deque_push(&deques[own], rest)) {
+            break;
+        }
+        notify();
+        task.end = middle;
+    }
+
+    long long start = depth == 0 ? now_ns() : 0;
+    depth++;
+
+    for (int i = task.begin; i < task.end; i++) {
+        job->fn(job->ctx, i);
+    }
+
+    depth--;
+    if (depth == 0) {
+        atomic_fetch_add(&busy_ns[own], now_ns() - start);
+    }
+
+    int count = task.end - task.begin;
+    if (atomic_fetch_sub(&job->pending, count) == count) {
+        notify();
+    }
+}
+
+// Pins the calling thread to the CPU of pool thread number `index`.
+static void pin_thread(int index) {
+    if (pinned_count == 0) {
+        return;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(pinned_cpus[index % pinned_count], &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+        u_error("[tpool] Failed to pin thread #%d to CPU %d.", index,
+            pinned_cpus[index % pinned_count]);
+    }
+}
+
+static void *worker_main(void *arg) {
+    own = (int)(intptr_t)arg;
+    victim_seed = own;
+    pin_thread(own);
+
+    for (;;) {
+        unsigned seen = atomic_load(&epoch);
+        Task task;
+
+        if (take_task(&task)) {
+            run_task(task);
+        } else if (atomic_load(&stopping)) {
+            break;
+        } else {
+            idle_wait(seen);
+        }
+    }
+
+    return NULL;
+}
+
+bool tpool_init(int threads, const int *cpus, int cpu_count) {
+    if (cpu_count > 0) {
+        pinned_cpus = malloc(sizeof(int) * cpu_count);
+        if (!pinned_cpus) {
+            u_error("[tpool_init] Failed to allocate CPU list!");
+            return false;
+        }
+        memcpy(pinned_cpus, cpus, sizeof(int) * cpu_count);
+        pinned_count = cpu_count;
+
+        // The calling thread works as thread #0
+        if (pthread_getaffinity_np(pthread_self(), sizeof(unpinned_set),
+            &unpinned_set)) {
+            CPU_ZERO(&unpinned_set);
+        }
+        pin_thread(0);
+    }
+
+    if (threads <= 1) {
+        return true;
+    }
+
+    workers = malloc(sizeof(pthread_t) * (threads - 1));
+    deques = malloc(sizeof(Deque) * threads);
+    busy_ns = malloc(sizeof(atomic_llong) * threads);
+    if (!workers || !deques || !busy_ns) {
+        u_error("[tpool_init] Failed to allocate workers!");
+        free(workers);
+        free(deques);
+        free(busy_ns);
+        workers = NULL;
+        deques = NULL;
+        busy_ns = NULL;
+        return false;
+    }
+
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_init(&deques[i].lock, NULL);
+        deques[i].top = 0;
+        deques[i].bottom = 0;
+        atomic_init(&busy_ns[i], 0);
+    }
+
+    deque_count = threads;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    atomic_store(&stopping, false);
+
+    for (worker_count = 0; worker_count < threads - 1; worker_count++) {
+        if (pthread_create(&workers[worker_count], NULL, worker_main,
+            (void *)(intptr_t)(worker_count + 1))) {
+            u_error("[tpool_init] Failed to start worker thread #%d.",
+                worker_count);
+            tpool_shutdown();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int tpool_threads(void) {
+    return worker_count + 1;
+}
+
+void tpool_for(int count, TaskFunc fn, void *ctx) {
+    if (worker_count == 0 || count <= 1) {
+        for (int i = 0; i < count; i++) {
+            fn(ctx, i);
+        }
+        return;
+    }
+
+    Job job = { fn, ctx, count / ((worker_count + 1) * SPLITS), count };
+    if (job.grain < 1) {
+        job.grain = 1;
+    }
+
+    run_task((Task){ &job, 0, count });
+
+    // Help with whatever is queued until the whole loop is done
+    for (;;) {
+        unsigned seen = atomic_load(&epoch);
+        Task task;
+
+        if (atomic_load(&job.pending) == 0) {
+            break;
+        }
+
+        if (take_task(&task)) {
+            run_task(task);
+        } else {
+            idle_wait(seen);
+        }
+    }
+}
+
+int tpool_spawn(pthread_t *thread, void *(*fn)(void *), void *arg) {
+    pthread_attr_t attr;
+    int rc = pthread_attr_init(&attr);
+    if (rc) {
+        return rc;
+    }
+
+    if (pinned_count > 0 && CPU_COUNT(&unpinned_set) > 0) {
+        pthread_attr_setaffinity_np(&attr, sizeof(unpinned_set),
+            &unpinned_set);
+    }
+    rc = pthread_create(thread, &attr, fn, arg);
+    pthread_attr_destroy(&attr);
+
+    return rc;
+}
+
+double tpool_utilisation(void) {
+    if (worker_count == 0) {
+        return 1.0;
+    }
+
+    long long elapsed = now_ns()
+        - (started.tv_sec * 1000000000LL + started.tv_nsec);
+    long long busy = 0;
+    for (int i = 0; i <= worker_count; i++) {
+        busy += atomic_load(&busy_ns[i]);
+    }
+
+    double utilisation = (double)busy / ((double)elapsed * (worker_count + 1));
+    return utilisation > 1.0 ? 1.0 : utilisation;
+}
+
+void tpool_shutdown(void) {
+    atomic_store(&stopping, true);
+    notify();
+
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    free(workers);
+    free(deques);
+    free(busy_ns);
+    free(pinned_cpus);
+    workers = NULL;
+    deques = NULL;
+    busy_ns = NULL;
+    pinned_cpus = NULL;
+    pinned_count = 0;
+    deque_count = 0;
+    worker_count = 0;
+}
+
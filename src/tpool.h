@@ -0,0 +1,29 @@
+#ifndef __TPOOL_H_
+#define __TPOOL_H_
+
+#include <stdbool.h>
+#include <pthread.h>
+
+typedef void (*TaskFunc)(void *ctx, int index);
+
+// Starts `threads - 1` workers. If `cpus` is given, the calling thread
+// and the workers are pinned to those CPUs in turn.
+bool tpool_init(int threads, const int *cpus, int cpu_count);
+int tpool_threads(void);
+
+// Calls `fn` for every index in [0, count) and returns when all calls
+// are done. Safe to call from any thread, including from inside `fn`.
+void tpool_for(int count, TaskFunc fn, void *ctx);
+
+// Starts a thread outside the pool, like pthread_create. The calling
+// thread is pinned by tpool_init, so this one gets back the CPUs the
+// process had before, instead of inheriting a single one.
+int tpool_spawn(pthread_t *thread, void *(*fn)(void *), void *arg);
+
+// Share of the time since tpool_init that pool threads spent on tasks.
+double tpool_utilisation(void);
+
+void tpool_shutdown(void);
+
+#endif
+
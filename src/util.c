@@ -3,6 +3,10 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "util.h"
 
@@ -76,3 +80,129 @@ const char *u_get_file_ext(const char *path) {
     return dot + 1;
 }
 
+uint8_t *u_read_file(FILE *file, const uint8_t *head, size_t head_length,
+    size_t *length) {
+    size_t capacity = 1 << 20;
+    size_t size = head_length;
+    while (capacity <= head_length) {
+        capacity *= 2;
+    }
+    uint8_t *data = malloc(capacity);
+    if (data && head_length > 0) {
+        memcpy(data, head, head_length);
+    }
+
+    while (data) {
+        size += fread(data + size, 1, capacity - size, file);
+        if (size < capacity) {
+            break;
+        }
+
+        capacity *= 2;
+        uint8_t *grown = realloc(data, capacity);
+        if (!grown) {
+            free(data);
+        }
+        data = grown;
+    }
+
+    if (!data) {
+        u_error("[u_read_file] Failed to allocate memory for file data!");
+        return NULL;
+    }
+
+    if (ferror(file)) {
+        u_error("[u_read_file] Failed to read file.");
+        free(data);
+        return NULL;
+    }
+
+    *length = size;
+    return data;
+}
+
+// Maps a regular, non-empty file read-only, or returns NULL.
+static uint8_t *u_map_file(const char *path, size_t *length) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    // Decoders go through it once, front to back
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    *length = st.st_size;
+    return data;
+}
+
+bool u_load_file(UFileData *self, const char *path) {
+    self->data = NULL;
+    self->length = 0;
+    self->mapped = false;
+
+    if (path) {
+        self->data = u_map_file(path, &self->length);
+        if (self->data) {
+            self->mapped = true;
+            return true;
+        }
+    }
+
+    FILE *file = path ? fopen(path, "rb") : stdin;
+    if (!file) {
+        u_error("File \"%s\" doesn't exist.", path);
+        return false;
+    }
+
+    self->data = u_read_file(file, NULL, 0, &self->length);
+    if (path) {
+        fclose(file);
+    }
+
+    return self->data != NULL;
+}
+
+void u_unload_file(UFileData *self) {
+    if (self->mapped) {
+        munmap(self->data, self->length);
+    } else {
+        free(self->data);
+    }
+
+    self->data = NULL;
+    self->length = 0;
+    self->mapped = false;
+}
+
+uint8_t *u_put_le16(uint8_t *p, unsigned v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    return p + 2;
+}
+
+uint8_t *u_put_le32(uint8_t *p, uint32_t v) {
+    p = u_put_le16(p, v & 0xFFFF);
+    return u_put_le16(p, v >> 16);
+}
+
+uint8_t *u_put_be16(uint8_t *p, unsigned v) {
+    p[0] = (v >> 8) & 0xFF;
+    p[1] = v & 0xFF;
+    return p + 2;
+}
+
+uint8_t *u_put_be32(uint8_t *p, uint32_t v) {
+    p = u_put_be16(p, v >> 16);
+    return u_put_be16(p, v & 0xFFFF);
+}
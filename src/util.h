@@ -2,6 +2,16 @@
 #ifndef __UTIL_H_
 #define __UTIL_H_
 
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    uint8_t *data;
+    size_t length;
+    bool mapped;
+} UFileData;
+
 extern int u_quiet;
 
 void u_debug(const char *fmt, ...);
@@ -9,6 +19,21 @@ void u_message(const char *fmt, ...);
 void u_error(const char *fmt, ...);
 void u_get_file_base(char *base, const char *path);
 const char *u_get_file_ext(const char *path);
+// Reads `file` to the end, after `head_length` bytes already read off it.
+uint8_t *u_read_file(FILE *file, const uint8_t *head, size_t head_length,
+    size_t *length);
+
+// Maps a regular file into memory, or reads it whole if it can't be
+// mapped. A NULL `path` reads stdin.
+bool u_load_file(UFileData *self, const char *path);
+void u_unload_file(UFileData *self);
+
+// Store little-endian values, returning the byte after them.
+uint8_t *u_put_le16(uint8_t *p, unsigned v);
+uint8_t *u_put_le32(uint8_t *p, uint32_t v);
+// Same for big-endian ones.
+uint8_t *u_put_be16(uint8_t *p, unsigned v);
+uint8_t *u_put_be32(uint8_t *p, uint32_t v);
 
 #define FRAND() (rand() / (double)RAND_MAX)
 #define LERP(a, b, t) ((a) * (1 - (t)) + (b) * (t))
@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "video.h"
+#include "stream.h"
+#include "picture.h"
+#include "queue.h"
+#include "tpool.h"
+#include "util.h"
+
+#define QUEUE_CAPACITY  4
+
+typedef struct {
+    Secamizer   *self;
+    Queue       *read_queue; // read -> scan
+    Queue       *scan_queue; // scan -> write
+    int         scan_failures;
+} Video;
+
+static void *video_read(void *arg) {
+    Video *video = arg;
+    Secamizer *self = video->self;
+    YCCPicture *frame;
+
+    while ((frame = stream_read_frame(self->video,
+        self->force_480 ? 480 : -1))) {
+        queue_push(video->read_queue, frame);
+    }
+
+    queue_push(video->read_queue, NULL);
+    return NULL;
+}
+
+static void *video_scan(void *arg) {
+    Video *video = arg;
+    Secamizer *self = video->self;
+    YCCPicture *source;
+
+    for (int i = 0; (source = queue_pop(video->read_queue)); i++) {
+        YCCPicture *frame = secamizer_scan_frame(self, source, i);
+        ycc_delete(&source);
+
+        if (!frame) {
+            video->scan_failures++;
+            continue;
+        }
+
+        queue_push(video->scan_queue, frame);
+    }
+
+    queue_push(video->scan_queue, NULL);
+    return NULL;
+}
+
+// Frames go out to stdout or to a file, in the format of the source
+// unless another one is asked for.
+static FILE *video_open_output(Secamizer *self, StreamWriter *writer) {
+    bool to_stdout = self->output_path == (const char *)0x57D;
+    const char *ext = self->forced_output_format;
+    if (!ext && !to_stdout) {
+        ext = u_get_file_ext(self->output_path);
+    }
+
+    writer->format = self->video->format;
+    writer->layout = self->video->layout;
+    if (ext && !stream_parse_format(ext, &writer->format, &writer->layout)) {
+        u_error("Video can't be written as %s!", ext);
+        return NULL;
+    }
+    if (to_stdout) {
+        return stdout;
+    }
+
+    FILE *file = fopen(self->output_path, "wb");
+    if (!file) {
+        u_error("Unable to open \"%s\" for write.", self->output_path);
+    }
+    return file;
+}
+
+bool video_run(Secamizer *self) {
+    Video video = { self, NULL, NULL, 0 };
+    int write_failures = 0;
+
+    StreamWriter writer = { 0 };
+    if (self->video->format == STREAM_Y4M) {
+        writer.tags = self->video->tags;
+    }
+
+    writer.file = video_open_output(self, &writer);
+    if (!writer.file) {
+        return false;
+    }
+
+    video.read_queue = queue_new(QUEUE_CAPACITY);
+    video.scan_queue = queue_new(QUEUE_CAPACITY);
+    if (!video.read_queue || !video.scan_queue) {
+        if (video.read_queue) {
+            queue_delete(&video.read_queue);
+        }
+        if (video.scan_queue) {
+            queue_delete(&video.scan_queue);
+        }
+        if (writer.file != stdout) {
+            fclose(writer.file);
+        }
+        return false;
+    }
+
+    pthread_t reader, scanner;
+    if (tpool_spawn(&reader, video_read, &video)
+        || tpool_spawn(&scanner, video_scan, &video)) {
+        u_error("[video_run] Failed to start pipeline threads.");
+        exit(EXIT_FAILURE);
+    }
+
+    // Writing runs right here, as the last stage
+    YCCPicture *frame;
+    while ((frame = queue_pop(video.scan_queue))) {
+        if (!stream_write_frame(&writer, frame)) {
+            write_failures++;
+        }
+        ycc_delete(&frame);
+    }
+
+    pthread_join(reader, NULL);
+    pthread_join(scanner, NULL);
+    stream_writer_free(&writer);
+
+    queue_delete(&video.read_queue);
+    queue_delete(&video.scan_queue);
+
+    if (writer.file == stdout) {
+        fflush(stdout);
+    } else {
+        fclose(writer.file);
+    }
+
+    return !self->video->failed
+        && video.scan_failures + write_failures == 0;
+}
+
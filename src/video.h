@@ -0,0 +1,17 @@
+#ifndef __VIDEO_H_
+#define __VIDEO_H_
+
+#include <stdbool.h>
+#include "secamizer.h"
+
+/*
+ * Secamizes a stream of frames, Y4M, raw YUV or MJPEG, from
+ * `self->video` to the output. Reading, scanning and writing run on
+ * threads of their own, with a few frames in flight between them at
+ * most, so that streams of any length go through in bounded memory.
+ * Returns false if a frame failed or the stream was cut short.
+ */
+bool video_run(Secamizer *self);
+
+#endif
+
@@ -0,0 +1,125 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "y4m.h"
+#include "util.h"
+
+#define Y4M_LINE_MAX    4096
+#define Y4M_FRAME       "FRAME"
+
+// Reads up to a newline, which is dropped. Returns false at the end of
+// the file or if the line doesn't fit.
+static bool y4m_read_line(FILE *file, char *line, size_t size) {
+    size_t length = 0;
+    int c;
+
+    while ((c = fgetc(file)) != EOF && c != '\n') {
+        if (length + 1 >= size) {
+            return false;
+        }
+        line[length++] = c;
+    }
+    line[length] = '\0';
+
+    return c == '\n';
+}
+
+// Tells if a colourspace is one of the 8-bit 4:2:0 ones, whichever the
+// chroma siting. The likes of 420p10 have deeper samples.
+static bool y4m_is_420(const char *colourspace) {
+    static const char *const names[] = {
+        "420", "420jpeg", "420paldv", "420mpeg2"
+    };
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(colourspace, names[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool y4m_read_header(FILE *file, int *width, int *height, char *tags) {
+    char line[Y4M_LINE_MAX];
+    size_t kept = 0;
+    char *state;
+
+    if (!y4m_read_line(file, line, sizeof(line))) {
+        u_error("[y4m_read_header] Y4M header is broken.");
+        return false;
+    }
+
+    *width = 0;
+    *height = 0;
+    tags[0] = '\0';
+
+    for (char *tag = strtok_r(line, " ", &state); tag;
+        tag = strtok_r(NULL, " ", &state)) {
+        switch (tag[0]) {
+        case 'W':
+            *width = atoi(tag + 1);
+            break;
+        case 'H':
+            *height = atoi(tag + 1);
+            break;
+        case 'C':
+            if (!y4m_is_420(tag + 1)) {
+                u_error("Y4M colourspace %s is not supported, only 8-bit "
+                    "4:2:0 is.", tag + 1);
+                return false;
+            }
+            break;
+        case 'X':
+            // Colourspace again, this time for a specific application
+            if (strncmp(tag, "XYSCSS=", 7) == 0) {
+                break;
+            }
+            // fallthrough
+        default:
+            if (kept + strlen(tag) + 2 > Y4M_TAGS_SIZE) {
+                break;
+            }
+            kept += sprintf(tags + kept, " %s", tag);
+            break;
+        }
+    }
+
+    if (*width < 4 || *height < 2) {
+        u_error("[y4m_read_header] Bad Y4M frame size %dx%d.",
+            *width, *height);
+        return false;
+    }
+
+    return true;
+}
+
+bool y4m_read_frame_header(FILE *file, bool *failed) {
+    char line[Y4M_LINE_MAX];
+
+    if (!y4m_read_line(file, line, sizeof(line))) {
+        if (!feof(file) || line[0] != '\0') {
+            u_error("[y4m_read_frame_header] Frame header is broken.");
+            *failed = true;
+        }
+        return false;
+    }
+
+    if (strncmp(line, Y4M_FRAME, strlen(Y4M_FRAME)) != 0) {
+        u_error("[y4m_read_frame_header] Expected a frame, got \"%.16s\".",
+            line);
+        *failed = true;
+        return false;
+    }
+
+    return true;
+}
+
+void y4m_write_header(FILE *file, int width, int height, const char *tags) {
+    fprintf(file, Y4M_SIGNATURE " W%d H%d%s C420jpeg\n", width, height,
+        tags ? tags : " F25:1");
+}
+
+void y4m_write_frame_header(FILE *file) {
+    fputs(Y4M_FRAME "\n", file);
+}
+
@@ -0,0 +1,29 @@
+#ifndef __Y4M_H_
+#define __Y4M_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#define Y4M_SIGNATURE   "YUV4MPEG2"
+#define Y4M_TAGS_SIZE   256
+
+/*
+ * Headers of YUV4MPEG2 streams. Frames in between are I420 frames as
+ * raw.h reads and writes them; other chroma layouts are refused.
+ */
+
+// Reads the stream header, the signature of which has been read off
+// `file` already, as that's how a stream is told from a picture. Tags
+// which still hold for our frames, the frame rate and such, go to
+// `tags`, which takes Y4M_TAGS_SIZE characters.
+bool y4m_read_header(FILE *file, int *width, int *height, char *tags);
+
+// Reads a frame header. Returns false at the end of the stream, and
+// sets `failed` unless the end was a clean one.
+bool y4m_read_frame_header(FILE *file, bool *failed);
+
+void y4m_write_header(FILE *file, int width, int height, const char *tags);
+void y4m_write_frame_header(FILE *file);
+
+#endif
+
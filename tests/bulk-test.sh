@@ -9,9 +9,6 @@ fi
 
 [ -d "./secamized" ] || mkdir -p "./secamized"
 
-for i in ./pictures/*; do
-  echo "-- $i..."
-  $SECAMIZER $* $i "./secamized/$(basename $i)"
-done
+$SECAMIZER $* -B "./secamized" ./pictures/*
 
 echo "-- Done!"